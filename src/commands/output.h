@@ -0,0 +1,243 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+// Everything an interpreter writes goes through its own buffer so program
+// output and messages stay in order. It is written out when full, before
+// reading input, when a script ends, and after every line when the file
+// descriptor is a terminal. A buffer with no file descriptor (-1) collects
+// everything written out in a growing capture instead.
+typedef struct {
+    char data[OUTPUT_BUFFER_SIZE];
+    int length;
+    int fd;
+    int line_buffered;
+    char* capture;
+    size_t capture_length;
+    size_t capture_capacity;
+} OutputBuffer;
+
+// The buffer of the interpreter running on this thread. Each interpreter
+// binds its own while it loads or runs a script.
+_Thread_local OutputBuffer* output = NULL;
+
+void InitOutput(OutputBuffer* buffer, int fd) {
+    buffer->length = 0;
+    buffer->fd = fd;
+    buffer->line_buffered = fd >= 0 && isatty(fd);
+    buffer->capture = NULL;
+    buffer->capture_length = 0;
+    buffer->capture_capacity = 0;
+}
+
+// Makes buffer the current one, returns the previous binding
+OutputBuffer* BindOutput(OutputBuffer* buffer) {
+    OutputBuffer* previous = output;
+    output = buffer;
+    return previous;
+}
+
+void WriteAll(int fd, const char* data, int length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        data += written;
+        length -= (int)written;
+    }
+}
+
+void WriteOutput(OutputBuffer* buffer, const char* data, int length) {
+    if (buffer->fd >= 0) {
+        WriteAll(buffer->fd, data, length);
+        return;
+    }
+    if (buffer->capture_length + length > buffer->capture_capacity) {
+        size_t capacity = buffer->capture_capacity ? buffer->capture_capacity : OUTPUT_BUFFER_SIZE;
+        while (capacity < buffer->capture_length + length) capacity *= 2;
+        buffer->capture = realloc(buffer->capture, capacity);
+        buffer->capture_capacity = capacity;
+    }
+    memcpy(buffer->capture + buffer->capture_length, data, length);
+    buffer->capture_length += length;
+}
+
+void FlushOutput(void) {
+    WriteOutput(output, output->data, output->length);
+    output->length = 0;
+}
+
+void OutputBytes(const char* data, int length) {
+    if (output->length + length > OUTPUT_BUFFER_SIZE) {
+        FlushOutput();
+        if (length > OUTPUT_BUFFER_SIZE) {
+            WriteOutput(output, data, length);
+            return;
+        }
+    }
+    memcpy(output->data + output->length, data, length);
+    output->length += length;
+}
+
+// Ends a line, writing it out right away when a person is watching
+void OutputNewline(void) {
+    if (output->length >= OUTPUT_BUFFER_SIZE) FlushOutput();
+    output->data[output->length++] = '\n';
+    if (output->line_buffered) FlushOutput();
+}
+
+void OutputText(const char* text) {
+    OutputBytes(text, (int)strlen(text));
+}
+
+// printf-style output for messages; values printed by scripts use the
+// dedicated formatters below
+void OutputFormat(const char* format, ...) {
+    char buffer[1024];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (length < 0) return;
+    if (length >= (int)sizeof(buffer)) length = sizeof(buffer) - 1;
+    OutputBytes(buffer, length);
+    if (output->line_buffered && memchr(buffer, '\n', length)) FlushOutput();
+}
+
+// Writes the decimal digits of value to out, returns the length
+int FormatInt(int value, char* out) {
+    char digits[10];
+    unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+    int count = 0;
+    do {
+        digits[count++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+
+    int length = 0;
+    if (value < 0) out[length++] = '-';
+    while (count > 0) out[length++] = digits[--count];
+    return length;
+}
+
+static const double float_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+    1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+    1e20, 1e21, 1e22, 1e23, 1e24, 1e25, 1e26, 1e27, 1e28, 1e29,
+    1e30, 1e31, 1e32, 1e33, 1e34, 1e35, 1e36, 1e37, 1e38, 1e39,
+    1e40, 1e41, 1e42, 1e43, 1e44, 1e45, 1e46, 1e47, 1e48, 1e49,
+    1e50, 1e51, 1e52, 1e53, 1e54
+};
+
+// x * 10^exponent for |exponent| <= 54
+double ScalePow10(double x, int exponent) {
+    return exponent >= 0 ? x * float_powers_of_ten[exponent] : x / float_powers_of_ten[-exponent];
+}
+
+// Writes the shortest decimal that reads back as the same float: 3.14,
+// 0.1, 100.0, 1e+20. Whole numbers keep a ".0" so floats never look like
+// ints. Returns the length.
+int FormatFloat(float value, char* out) {
+    int length = 0;
+    if (value != value) {
+        memcpy(out, "nan", 3);
+        return 3;
+    }
+
+    unsigned int bits;
+    memcpy(&bits, &value, sizeof(bits));
+    if (bits >> 31) out[length++] = '-';
+    bits &= 0x7fffffffu;
+    float magnitude;
+    memcpy(&magnitude, &bits, sizeof(magnitude));
+
+    if (bits == 0x7f800000u) {
+        memcpy(out + length, "inf", 3);
+        return length + 3;
+    }
+    if (bits == 0) {
+        memcpy(out + length, "0.0", 3);
+        return length + 3;
+    }
+
+    // Decimal exponent of the leading digit, estimated from the binary one
+    double x = magnitude;
+    int exponent = ((int)(bits >> 23) - 127) * 78913 >> 18;
+    while (ScalePow10(x, -exponent) >= 10.0) exponent++;
+    while (ScalePow10(x, -exponent) < 1.0) exponent--;
+
+    // Fewest significant digits that round-trip; nine always do
+    long long digits = 0;
+    int precision;
+    for (precision = 1; precision <= 9; precision++) {
+        int scale = exponent - precision + 1;
+        digits = (long long)(ScalePow10(x, -scale) + 0.5);
+        if ((float)ScalePow10((double)digits, scale) == magnitude) break;
+    }
+    if (precision > 9) precision = 9;
+    if (digits >= (long long)float_powers_of_ten[precision]) {
+        // Rounding carried into a new leading digit
+        digits /= 10;
+        exponent++;
+    }
+    while (precision > 1 && digits % 10 == 0) {
+        digits /= 10;
+        precision--;
+    }
+
+    char text[10];
+    for (int i = precision - 1; i >= 0; i--) {
+        text[i] = (char)('0' + digits % 10);
+        digits /= 10;
+    }
+
+    if (exponent >= -5 && exponent < 16) {
+        if (exponent < 0) {
+            out[length++] = '0';
+            out[length++] = '.';
+            for (int i = -1; i > exponent; i--) out[length++] = '0';
+            memcpy(out + length, text, precision);
+            return length + precision;
+        }
+        for (int i = 0; i <= exponent; i++) out[length++] = i < precision ? text[i] : '0';
+        out[length++] = '.';
+        if (precision <= exponent + 1) {
+            out[length++] = '0';
+        } else {
+            memcpy(out + length, text + exponent + 1, precision - exponent - 1);
+            length += precision - exponent - 1;
+        }
+        return length;
+    }
+
+    out[length++] = text[0];
+    if (precision > 1) {
+        out[length++] = '.';
+        memcpy(out + length, text + 1, precision - 1);
+        length += precision - 1;
+    }
+    out[length++] = 'e';
+    out[length++] = exponent < 0 ? '-' : '+';
+    int magnitude_exponent = exponent < 0 ? -exponent : exponent;
+    if (magnitude_exponent < 10) out[length++] = '0';
+    return length + FormatInt(magnitude_exponent, out + length);
+}
+
+void OutputInt(int value) {
+    char text[16];
+    OutputBytes(text, FormatInt(value, text));
+}
+
+void OutputFloat(float value) {
+    char text[32];
+    OutputBytes(text, FormatFloat(value, text));
+}
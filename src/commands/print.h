@@ -3,23 +3,28 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include "output.h"
 
 void Print(const char* value) {
-    printf("%s\n", value);
+    OutputText(value);
+    OutputNewline();
 }
 
 void PrintInt(int value) {
-    printf("%d\n", value);
+    OutputInt(value);
+    OutputNewline();
 }
 
 void PrintFloat(float value) {
-    printf("%f\n", value);
+    OutputFloat(value);
+    OutputNewline();
 }
 
 void PrintBool(int value) {
     if (value) {
-        printf("true\n");
+        OutputText("true");
     } else {
-        printf("false\n");
+        OutputText("false");
     }
-}
\ No newline at end of file
+    OutputNewline();
+}
@@ -0,0 +1,4 @@
+// The one translation unit that includes the interpreter's headers. They
+// define their functions in place, so everything else uses interpreter.h.
+#include "interpreter.h"
+#include "../proccess_command/proccess_command.h"
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+
+// Public interface of the interpreter. Each Interpreter owns everything a
+// script needs, so independent scripts can run at the same time on
+// different threads. One interpreter must only be used by one thread at a
+// time.
+typedef struct Interpreter Interpreter;
+
+typedef struct {
+    long long instruction_limit;    // 0 for no limit
+    double timeout_seconds;         // 0 for no deadline
+    int max_call_depth;             // 0 for the default of 10000
+    int no_tail_calls;              // Keep every call on the stack
+    int output_fd;                  // Where the script writes, 0 for stdout
+    const char* cache_dir;          // Directory of compiled scripts, or NULL
+    const char* profile_path;       // Profile each run into this file and
+                                    // print its hot spots to stderr
+    const char* sample_path;        // Sample the call stack of each run and
+                                    // write folded stacks to this file
+    int optimize_level;             // 0 for the default of 1, -1 for none
+    const char* passes;             // Comma-separated optimizer passes to
+                                    // run instead of those of the level
+    int dump_ir;                    // Print the tree before and after the
+                                    // optimizer and the bytecode to stderr
+    int no_jit;                     // Interpret everything, even where the
+                                    // JIT is built in
+} InterpreterOptions;
+
+// NULL options gives the defaults
+Interpreter* CreateInterpreter(const InterpreterOptions* options);
+
+// Parse and compile a script, replacing any loaded before. A NULL or "-"
+// filename reads standard input. Returns 0 if the script could not be read
+// or has errors, which have been reported on the interpreter's output.
+int LoadScript(Interpreter* interpreter, const char* filename);
+int LoadScriptText(Interpreter* interpreter, const char* text, size_t length);
+
+// Runs the loaded script from the start. Returns 0 if nothing is loaded or
+// the script was stopped by a limit.
+int RunScript(Interpreter* interpreter);
+
+// Runs the loaded script once per input file, with input statements
+// reading from that file, on jobs threads (0 for one per core). All runs
+// share the compiled script; each has its own variables and output, and
+// the outputs are written in input order. Returns 0 if any input could not
+// be opened or any run was stopped by a limit.
+int RunBatch(Interpreter* interpreter, const char* const* inputs, int input_count, int jobs);
+
+void DestroyInterpreter(Interpreter* interpreter);
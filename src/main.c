@@ -1,9 +1,72 @@
 #include <stdio.h>
-#include "proccess_command/proccess_command.h"
+#include <stdlib.h>
+#include <string.h>
+#include "interpreter/interpreter.h"
+
+void PrintUsage(const char* program) {
+    printf("Usage: %s [--budget N] [--timeout SECONDS] [--stack-size N] [--no-tail-calls] [--cache DIR] [--profile FILE] [--sample FILE]\n"
+           "       [-O0|-O1|-O2] [--passes LIST] [--dump-ir] [--no-jit] [script]\n", program);
+    printf("       %s [options] [--jobs N] --batch script input...\n", program);
+}
 
 int main(int argc, char *argv[]) 
 {
+    const char* filename = NULL;
+    InterpreterOptions options = {0};
+    int batch = 0;
+    int jobs = 0;
+    const char** inputs = calloc(argc, sizeof(char*));
+    int input_count = 0;
 
-    ProcessCommand(argv[1]);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+            options.instruction_limit = atoll(argv[++i]);
+        } else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc) {
+            options.timeout_seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--stack-size") == 0 && i + 1 < argc) {
+            options.max_call_depth = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--no-tail-calls") == 0) {
+            options.no_tail_calls = 1;
+        } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            options.cache_dir = argv[++i];
+        } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            options.profile_path = argv[++i];
+        } else if (strcmp(argv[i], "--sample") == 0 && i + 1 < argc) {
+            options.sample_path = argv[++i];
+        } else if (strcmp(argv[i], "-O0") == 0) {
+            options.optimize_level = -1;
+        } else if (strcmp(argv[i], "-O1") == 0 || strcmp(argv[i], "-O2") == 0) {
+            options.optimize_level = argv[i][2] - '0';
+        } else if (strcmp(argv[i], "--passes") == 0 && i + 1 < argc) {
+            options.passes = argv[++i];
+        } else if (strcmp(argv[i], "--dump-ir") == 0) {
+            options.dump_ir = 1;
+        } else if (strcmp(argv[i], "--no-jit") == 0) {
+            options.no_jit = 1;
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            batch = 1;
+        } else if (argv[i][0] == '-' && argv[i][1] == '-') {
+            PrintUsage(argv[0]);
+            free(inputs);
+            return 1;
+        } else if (filename == NULL || !batch) {
+            filename = argv[i];
+        } else {
+            inputs[input_count++] = argv[i];
+        }
+    }
 
-}
\ No newline at end of file
+    // Exits with 1 if the script has errors and 2 if a run was stopped by
+    // a limit or a batch input could not be opened
+    Interpreter* interpreter = CreateInterpreter(&options);
+    int status = 1;
+    if (LoadScript(interpreter, filename)) {
+        int ok = batch ? RunBatch(interpreter, inputs, input_count, jobs) : RunScript(interpreter);
+        status = ok ? 0 : 2;
+    }
+    DestroyInterpreter(interpreter);
+    free(inputs);
+    return status;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+// Bump allocator. Everything allocated from an arena is released together,
+// either all at once with FreeArena or back to a saved mark with
+// ArenaRelease.
+typedef struct ArenaBlock {
+    struct ArenaBlock* prev;
+    size_t size;
+    size_t used;
+    char data[];
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock* head;
+} Arena;
+
+typedef struct {
+    ArenaBlock* block;
+    size_t used;
+} ArenaMark;
+
+// Returns zeroed memory aligned for any scalar type
+void* ArenaAlloc(Arena* arena, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    ArenaBlock* block = arena->head;
+    if (block == NULL || block->used + size > block->size) {
+        size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(ArenaBlock) + block_size);
+        block->prev = arena->head;
+        block->size = block_size;
+        block->used = 0;
+        arena->head = block;
+    }
+    void* memory = block->data + block->used;
+    block->used += size;
+    memset(memory, 0, size);
+    return memory;
+}
+
+// Grows an arena allocation by copying; the old copy stays in the arena
+void* ArenaGrow(Arena* arena, void* memory, size_t old_size, size_t new_size) {
+    void* grown = ArenaAlloc(arena, new_size);
+    if (memory) memcpy(grown, memory, old_size);
+    return grown;
+}
+
+char* ArenaStrndup(Arena* arena, const char* text, size_t length) {
+    char* copy = ArenaAlloc(arena, length + 1);
+    memcpy(copy, text, length);
+    return copy;
+}
+
+ArenaMark ArenaSave(const Arena* arena) {
+    ArenaMark mark = { arena->head, arena->head ? arena->head->used : 0 };
+    return mark;
+}
+
+// Frees everything allocated since mark was saved
+void ArenaRelease(Arena* arena, ArenaMark mark) {
+    while (arena->head != mark.block) {
+        ArenaBlock* prev = arena->head->prev;
+        free(arena->head);
+        arena->head = prev;
+    }
+    if (arena->head) arena->head->used = mark.used;
+}
+
+void FreeArena(Arena* arena) {
+    ArenaMark empty = { NULL, 0 };
+    ArenaRelease(arena, empty);
+}
@@ -1,30 +1,21 @@
 #pragma once
 
 #include "../variable/symbol_table.h"
+#include "../parser/ast.h"
+#include "../commands/output.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
-#include <ctype.h>
 
-Value EvaluateExpression(VarType* result_type, char* tokens[], int start, int count) {
+// Applies a unary operator. On a type error the message is printed and
+// result_type is left TYPE_UNKNOWN.
+Value ApplyUnary(Operator op, VarType* result_type, VarType sub_type, Value sub_val) {
     Value result = {0};
     *result_type = TYPE_UNKNOWN;
-    
-    if (count == 0) {
-        return result;
-    }
-
-    // Handle parentheses
-    if (strcmp(tokens[start], "(") == 0 && strcmp(tokens[start+count-1], ")") == 0) {
-        return EvaluateExpression(result_type, tokens, start+1, count-2);
-    }
 
-    // Handle unary operators
-    if (count >= 2 && strcmp(tokens[start], "!") == 0) {
-        VarType sub_type;
-        Value sub_val = EvaluateExpression(&sub_type, tokens, start+1, count-1);
+    if (op == OPR_NOT) {
         if (sub_type != TYPE_BOOL) {
-            printf("Type mismatch for '!' operator\n");
+            OutputFormat("Type mismatch for '!' operator\n");
             return result;
         }
         result.boolValue = !sub_val.boolValue;
@@ -32,183 +23,115 @@ Value EvaluateExpression(VarType* result_type, char* tokens[], int start, int co
         return result;
     }
 
-    // Handle single token
-    if (count == 1) {
-        char* token = tokens[start];
-        char* endptr;
-        
-        // Check for variable
-        Variable* var = FindVariable(token);
-        if (var != NULL) {
-            *result_type = var->type;
-            return var->value;
-        }
-        
-        // Check integer
-        long intVal = strtol(token, &endptr, 10);
-        if (*endptr == '\0') {
-            result.intValue = (int)intVal;
-            *result_type = TYPE_INT;
-            return result;
-        }
-        
-        // Check float
-        float floatVal = strtof(token, &endptr);
-        if (*endptr == '\0') {
-            result.floatValue = floatVal;
-            *result_type = TYPE_FLOAT;
-            return result;
-        }
-        
-        // Check boolean
-        if (strcmp(token, "true") == 0) {
-            result.boolValue = 1;
-            *result_type = TYPE_BOOL;
-            return result;
-        }
-        if (strcmp(token, "false") == 0) {
-            result.boolValue = 0;
-            *result_type = TYPE_BOOL;
-            return result;
-        }
-        
-        // Default to string
-        result.stringValue = strdup(token);
-        *result_type = TYPE_STRING;
+    if (sub_type == TYPE_INT) {
+        result.intValue = (int)(0u - (unsigned int)sub_val.intValue);
+    } else if (sub_type == TYPE_FLOAT) {
+        result.floatValue = -sub_val.floatValue;
+    } else {
+        OutputFormat("Type mismatch for '-' operator\n");
         return result;
     }
+    *result_type = sub_type;
+    return result;
+}
 
-    // Handle binary operations
-    for (int i = start + 1; i < start + count - 1; i++) {
-        char* op = tokens[i];
-        
-        // Logical OR (lowest precedence)
-        if (strcmp(op, "||") == 0) {
-            VarType type1, type2;
-            Value val1 = EvaluateExpression(&type1, tokens, start, i - start);
-            Value val2 = EvaluateExpression(&type2, tokens, i+1, start + count - i - 1);
-            
-            if (type1 != TYPE_BOOL || type2 != TYPE_BOOL) {
-                printf("Type mismatch for '||' operator\n");
-                return result;
-            }
-            
-            result.boolValue = val1.boolValue || val2.boolValue;
-            *result_type = TYPE_BOOL;
-            return result;
-        }
-    }
+// Applies a binary operator to two evaluated operands
+Value ApplyOperator(Operator op, VarType* result_type,
+                    VarType type1, Value val1, VarType type2, Value val2) {
+    Value result = {0};
+    *result_type = TYPE_UNKNOWN;
 
-    for (int i = start + 1; i < start + count - 1; i++) {
-        char* op = tokens[i];
-        
-        // Logical AND
-        if (strcmp(op, "&&") == 0) {
-            VarType type1, type2;
-            Value val1 = EvaluateExpression(&type1, tokens, start, i - start);
-            Value val2 = EvaluateExpression(&type2, tokens, i+1, start + count - i - 1);
-            
+    switch (op) {
+        case OPR_OR:
+        case OPR_AND:
             if (type1 != TYPE_BOOL || type2 != TYPE_BOOL) {
-                printf("Type mismatch for '&&' operator\n");
+                OutputFormat("Type mismatch for '%s' operator\n", op == OPR_OR ? "||" : "&&");
                 return result;
             }
-            
-            result.boolValue = val1.boolValue && val2.boolValue;
+            if (op == OPR_OR) result.boolValue = val1.boolValue || val2.boolValue;
+            else result.boolValue = val1.boolValue && val2.boolValue;
             *result_type = TYPE_BOOL;
             return result;
-        }
-    }
 
-    for (int i = start + 1; i < start + count - 1; i++) {
-        char* op = tokens[i];
-        
-        // Comparison operators
-        if (strcmp(op, "==") == 0 || strcmp(op, "!=") == 0 || 
-            strcmp(op, "<") == 0 || strcmp(op, ">") == 0 ||
-            strcmp(op, "<=") == 0 || strcmp(op, ">=") == 0) {
-            
-            VarType type1, type2;
-            Value val1 = EvaluateExpression(&type1, tokens, start, i - start);
-            Value val2 = EvaluateExpression(&type2, tokens, i+1, start + count - i - 1);
-            
+        case OPR_EQ:
+        case OPR_NE:
+        case OPR_LT:
+        case OPR_GT:
+        case OPR_LE:
+        case OPR_GE: {
             // Type checking
             if (type1 != type2 || (type1 != TYPE_INT && type1 != TYPE_FLOAT)) {
-                printf("Type mismatch for comparison operator\n");
+                OutputFormat("Type mismatch for comparison operator\n");
                 return result;
             }
-            
+
             int cmp;
             if (type1 == TYPE_INT) {
                 cmp = (val1.intValue > val2.intValue) - (val1.intValue < val2.intValue);
             } else {
                 cmp = (val1.floatValue > val2.floatValue) - (val1.floatValue < val2.floatValue);
             }
-            
-            if (strcmp(op, "==") == 0) result.boolValue = (cmp == 0);
-            else if (strcmp(op, "!=") == 0) result.boolValue = (cmp != 0);
-            else if (strcmp(op, "<") == 0) result.boolValue = (cmp < 0);
-            else if (strcmp(op, ">") == 0) result.boolValue = (cmp > 0);
-            else if (strcmp(op, "<=") == 0) result.boolValue = (cmp <= 0);
-            else if (strcmp(op, ">=") == 0) result.boolValue = (cmp >= 0);
-            
+
+            switch (op) {
+                case OPR_EQ: result.boolValue = (cmp == 0); break;
+                case OPR_NE: result.boolValue = (cmp != 0); break;
+                case OPR_LT: result.boolValue = (cmp < 0); break;
+                case OPR_GT: result.boolValue = (cmp > 0); break;
+                case OPR_LE: result.boolValue = (cmp <= 0); break;
+                default: result.boolValue = (cmp >= 0); break;
+            }
             *result_type = TYPE_BOOL;
             return result;
         }
+
+        default:
+            break;
     }
 
-    for (int i = start + 1; i < start + count - 1; i++) {
-        char* op = tokens[i];
-        
-        // Arithmetic operators
-        if (strcmp(op, "+") == 0 || strcmp(op, "-") == 0 || 
-            strcmp(op, "*") == 0 || strcmp(op, "/") == 0) {
-            
-            VarType type1, type2;
-            Value val1 = EvaluateExpression(&type1, tokens, start, i - start);
-            Value val2 = EvaluateExpression(&type2, tokens, i+1, start + count - i - 1);
-            
-            // Type checking
-            if ((type1 != TYPE_INT && type1 != TYPE_FLOAT) || 
-                (type2 != TYPE_INT && type2 != TYPE_FLOAT)) {
-                printf("Type mismatch for arithmetic operator\n");
-                return result;
-            }
-            
-            // Determine result type (promote to float if either is float)
-            if (type1 == TYPE_FLOAT || type2 == TYPE_FLOAT) {
-                float fval1 = (type1 == TYPE_FLOAT) ? val1.floatValue : (float)val1.intValue;
-                float fval2 = (type2 == TYPE_FLOAT) ? val2.floatValue : (float)val2.intValue;
-                
-                if (strcmp(op, "+") == 0) result.floatValue = fval1 + fval2;
-                else if (strcmp(op, "-") == 0) result.floatValue = fval1 - fval2;
-                else if (strcmp(op, "*") == 0) result.floatValue = fval1 * fval2;
-                else if (strcmp(op, "/") == 0) {
-                    if (fval2 == 0.0f) {
-                        printf("Division by zero\n");
-                        return result;
-                    }
-                    result.floatValue = fval1 / fval2;
+    // Arithmetic operators
+    if ((type1 != TYPE_INT && type1 != TYPE_FLOAT) ||
+        (type2 != TYPE_INT && type2 != TYPE_FLOAT)) {
+        OutputFormat("Type mismatch for arithmetic operator\n");
+        return result;
+    }
+
+    // Determine result type (promote to float if either is float)
+    if (type1 == TYPE_FLOAT || type2 == TYPE_FLOAT) {
+        float fval1 = (type1 == TYPE_FLOAT) ? val1.floatValue : (float)val1.intValue;
+        float fval2 = (type2 == TYPE_FLOAT) ? val2.floatValue : (float)val2.intValue;
+
+        switch (op) {
+            case OPR_ADD: result.floatValue = fval1 + fval2; break;
+            case OPR_SUB: result.floatValue = fval1 - fval2; break;
+            case OPR_MUL: result.floatValue = fval1 * fval2; break;
+            default:
+                if (fval2 == 0.0f) {
+                    OutputFormat("Division by zero\n");
+                    return result;
                 }
-                
-                *result_type = TYPE_FLOAT;
-            } else {
-                if (strcmp(op, "+") == 0) result.intValue = val1.intValue + val2.intValue;
-                else if (strcmp(op, "-") == 0) result.intValue = val1.intValue - val2.intValue;
-                else if (strcmp(op, "*") == 0) result.intValue = val1.intValue * val2.intValue;
-                else if (strcmp(op, "/") == 0) {
-                    if (val2.intValue == 0) {
-                        printf("Division by zero\n");
-                        return result;
-                    }
-                    result.intValue = val1.intValue / val2.intValue;
+                result.floatValue = fval1 / fval2;
+                break;
+        }
+        *result_type = TYPE_FLOAT;
+    } else {
+        // Integer arithmetic wraps around, like the VM's quickened forms
+        unsigned int u = (unsigned int)val1.intValue;
+        unsigned int v = (unsigned int)val2.intValue;
+        switch (op) {
+            case OPR_ADD: result.intValue = (int)(u + v); break;
+            case OPR_SUB: result.intValue = (int)(u - v); break;
+            case OPR_MUL: result.intValue = (int)(u * v); break;
+            default:
+                if (val2.intValue == 0) {
+                    OutputFormat("Division by zero\n");
+                    return result;
                 }
-                
-                *result_type = TYPE_INT;
-            }
-            return result;
+                // The one quotient that overflows wraps to itself
+                if (val2.intValue == -1) result.intValue = (int)(0u - u);
+                else result.intValue = val1.intValue / val2.intValue;
+                break;
         }
+        *result_type = TYPE_INT;
     }
-    
-    printf("Unsupported expression format\n");
     return result;
-}
\ No newline at end of file
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "../variable/symbol_table.h"
+#include "../parser/ast.h"
+#include "expression.h"
+
+// Constant folding over the parsed program. An operator whose operands are
+// all literals is evaluated once here and replaced by its result, so the
+// compiler emits a single LOADK for it. Anything that would report an error
+// at runtime (type mismatch, division by zero) is left alone so the message
+// still appears when the line runs.
+
+int IsNumericType(VarType type) {
+    return type == TYPE_INT || type == TYPE_FLOAT;
+}
+
+int CanFoldUnary(Operator op, const Expr* x) {
+    if (op == OPR_NOT) return x->type == TYPE_BOOL;
+    if (x->type == TYPE_INT) return x->value.intValue != -2147483647 - 1;
+    return x->type == TYPE_FLOAT;
+}
+
+int CanFoldBinary(Operator op, const Expr* x, const Expr* y) {
+    switch (op) {
+        case OPR_AND:
+        case OPR_OR:
+            return x->type == TYPE_BOOL && y->type == TYPE_BOOL;
+        case OPR_EQ:
+        case OPR_NE:
+        case OPR_LT:
+        case OPR_GT:
+        case OPR_LE:
+        case OPR_GE:
+            return x->type == y->type && IsNumericType(x->type);
+        case OPR_DIV:
+            if (!IsNumericType(x->type) || !IsNumericType(y->type)) return 0;
+            if (y->type == TYPE_FLOAT) return y->value.floatValue != 0.0f;
+            if (x->type == TYPE_FLOAT) return y->value.intValue != 0;
+            return y->value.intValue != 0 &&
+                   !(x->value.intValue == -2147483647 - 1 && y->value.intValue == -1);
+        default:
+            return IsNumericType(x->type) && IsNumericType(y->type);
+    }
+}
+
+// Integer +, - and * wrap the same way the VM fast path does
+Value FoldBinary(Operator op, VarType* result_type, const Expr* x, const Expr* y) {
+    if (x->type == TYPE_INT && y->type == TYPE_INT &&
+        (op == OPR_ADD || op == OPR_SUB || op == OPR_MUL)) {
+        unsigned int u = (unsigned int)x->value.intValue;
+        unsigned int v = (unsigned int)y->value.intValue;
+        Value result;
+        result.intValue = (int)(op == OPR_ADD ? u + v : op == OPR_SUB ? u - v : u * v);
+        *result_type = TYPE_INT;
+        return result;
+    }
+    return ApplyOperator(op, result_type, x->type, x->value, y->type, y->value);
+}
+
+void FoldExpression(Expr* expr) {
+    if (expr == NULL || expr->kind == EXPR_LITERAL || expr->kind == EXPR_VARIABLE) return;
+    if (expr->kind == EXPR_CALL) {
+        for (int i = 0; i < expr->arg_count; i++) FoldExpression(expr->args[i]);
+        return;
+    }
+
+    FoldExpression(expr->left);
+    FoldExpression(expr->right);
+    if (expr->left->kind != EXPR_LITERAL) return;
+
+    VarType type;
+    Value value;
+    if (expr->kind == EXPR_UNARY) {
+        if (!CanFoldUnary(expr->op, expr->left)) return;
+        value = ApplyUnary(expr->op, &type, expr->left->type, expr->left->value);
+    } else {
+        if (expr->right->kind != EXPR_LITERAL) return;
+        if (!CanFoldBinary(expr->op, expr->left, expr->right)) return;
+        value = FoldBinary(expr->op, &type, expr->left, expr->right);
+    }
+
+    // The operand nodes stay in the program arena until it is freed
+    expr->left = NULL;
+    expr->right = NULL;
+    expr->kind = EXPR_LITERAL;
+    expr->type = type;
+    expr->value = value;
+}
+
+void FoldBlock(Block* block);
+
+void FoldStatement(Stmt* stmt) {
+    if (stmt == NULL) return;
+    FoldExpression(stmt->expr);
+    for (int i = 0; i < stmt->arg_count; i++) {
+        FoldExpression(stmt->args[i]);
+    }
+    FoldStatement(stmt->init);
+    FoldStatement(stmt->increment);
+    FoldBlock(&stmt->body);
+    FoldBlock(&stmt->else_body);
+}
+
+void FoldBlock(Block* block) {
+    for (int i = 0; i < block->count; i++) {
+        FoldStatement(block->items[i]);
+    }
+}
+
+void FoldProgram(Program* program) {
+    FoldBlock(&program->main);
+}
@@ -0,0 +1,881 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "../variable/symbol_table.h"
+#include "../parser/ast.h"
+#include "../commands/output.h"
+#include "fold.h"
+
+// Optimization passes over the parsed program, run between parsing and
+// compiling. Every pass rewrites the tree in place and keeps what the
+// script prints exactly the same, runtime error messages included, so a
+// rewrite it cannot prove safe is skipped. Scopes are the compiler's: a
+// declaration in the top-level code is a global, one in a function a local
+// of the whole function, whatever block it sits in.
+
+#define DEFAULT_OPTIMIZE_LEVEL 1
+
+typedef void (*ExprVisitor)(Expr* expr, void* context);
+
+// Calls visit on expr and every expression inside it, outermost first
+void VisitExpression(Expr* expr, ExprVisitor visit, void* context) {
+    if (expr == NULL) return;
+    visit(expr, context);
+    VisitExpression(expr->left, visit, context);
+    VisitExpression(expr->right, visit, context);
+    for (int i = 0; i < expr->arg_count; i++) VisitExpression(expr->args[i], visit, context);
+}
+
+void VisitBlock(Block* block, ExprVisitor visit, void* context);
+
+// Visits every expression of stmt and the statements nested in it. Function
+// bodies are left to their own visit.
+void VisitStatement(Stmt* stmt, ExprVisitor visit, void* context) {
+    if (stmt == NULL || stmt->kind == STMT_FUNCTION) return;
+    VisitExpression(stmt->expr, visit, context);
+    for (int i = 0; i < stmt->arg_count; i++) VisitExpression(stmt->args[i], visit, context);
+    VisitStatement(stmt->init, visit, context);
+    VisitStatement(stmt->increment, visit, context);
+    VisitBlock(&stmt->body, visit, context);
+    VisitBlock(&stmt->else_body, visit, context);
+}
+
+void VisitBlock(Block* block, ExprVisitor visit, void* context) {
+    for (int i = 0; i < block->count; i++) VisitStatement(block->items[i], visit, context);
+}
+
+int BlockContainsStatement(const Block* block, StmtKind kind);
+
+// Whether stmt is of kind or has a statement of kind nested in it, for-loop
+// clauses included and function bodies excluded
+int ContainsStatement(const Stmt* stmt, StmtKind kind) {
+    if (stmt == NULL) return 0;
+    if (stmt->kind == kind) return 1;
+    if (stmt->kind == STMT_FUNCTION) return 0;
+    return ContainsStatement(stmt->init, kind) || ContainsStatement(stmt->increment, kind) ||
+           BlockContainsStatement(&stmt->body, kind) || BlockContainsStatement(&stmt->else_body, kind);
+}
+
+int BlockContainsStatement(const Block* block, StmtKind kind) {
+    for (int i = 0; i < block->count; i++) {
+        if (ContainsStatement(block->items[i], kind)) return 1;
+    }
+    return 0;
+}
+
+int ExpressionHasCall(const Expr* expr) {
+    if (expr == NULL) return 0;
+    if (expr->kind == EXPR_CALL) return 1;
+    return ExpressionHasCall(expr->left) || ExpressionHasCall(expr->right);
+}
+
+int BlockHasCall(const Block* block);
+
+int StatementHasCall(const Stmt* stmt) {
+    if (stmt == NULL || stmt->kind == STMT_FUNCTION) return 0;
+    if (stmt->kind == STMT_CALL || ExpressionHasCall(stmt->expr)) return 1;
+    return StatementHasCall(stmt->init) || StatementHasCall(stmt->increment) ||
+           BlockHasCall(&stmt->body) || BlockHasCall(&stmt->else_body);
+}
+
+int BlockHasCall(const Block* block) {
+    for (int i = 0; i < block->count; i++) {
+        if (StatementHasCall(block->items[i])) return 1;
+    }
+    return 0;
+}
+
+// Number of declarations, assignments and inputs of every name, counted
+// in one walk
+typedef struct {
+    NameTable names;
+    int* counts;
+    int capacity;
+} StoreCounts;
+
+void CountBlockStores(StoreCounts* stores, const Block* block, int into_functions);
+
+void CountStores(StoreCounts* stores, const Stmt* stmt, int into_functions) {
+    if (stmt == NULL) return;
+    if (stmt->kind == STMT_FUNCTION) {
+        if (into_functions) CountBlockStores(stores, &stmt->body, 1);
+        return;
+    }
+    if (stmt->kind == STMT_DECLARE || stmt->kind == STMT_ASSIGN || stmt->kind == STMT_INPUT) {
+        int id = InternName(&stores->names, stmt->name);
+        if (id >= stores->capacity) {
+            stores->counts = realloc(stores->counts, stores->names.capacity * sizeof(int));
+            memset(stores->counts + stores->capacity, 0,
+                   (stores->names.capacity - stores->capacity) * sizeof(int));
+            stores->capacity = stores->names.capacity;
+        }
+        stores->counts[id]++;
+    }
+    CountStores(stores, stmt->init, into_functions);
+    CountStores(stores, stmt->increment, into_functions);
+    CountBlockStores(stores, &stmt->body, into_functions);
+    CountBlockStores(stores, &stmt->else_body, into_functions);
+}
+
+void CountBlockStores(StoreCounts* stores, const Block* block, int into_functions) {
+    for (int i = 0; i < block->count; i++) CountStores(stores, block->items[i], into_functions);
+}
+
+int StoreCount(const StoreCounts* stores, const char* name) {
+    int id = LookupName(&stores->names, name);
+    return id >= 0 ? stores->counts[id] : 0;
+}
+
+void FreeStoreCounts(StoreCounts* stores) {
+    FreeNameTable(&stores->names);
+    free(stores->counts);
+}
+
+int IsParameter(const Stmt* function, const char* name) {
+    for (int i = 0; function && i < function->param_count; i++) {
+        if (strcmp(function->params[i], name) == 0) return 1;
+    }
+    return 0;
+}
+
+// Variables of one scope with the type their first declaration gave them
+typedef struct {
+    NameTable names;
+    VarType* types;
+} TypedNames;
+
+void AddTypedName(TypedNames* table, const char* name, VarType type) {
+    if (LookupName(&table->names, name) >= 0) return;
+    int id = InternName(&table->names, name);
+    table->types = realloc(table->types, table->names.capacity * sizeof(VarType));
+    table->types[id] = type;
+}
+
+void CollectTypedNames(TypedNames* table, const Block* block) {
+    for (int i = 0; i < block->count; i++) {
+        const Stmt* stmt = block->items[i];
+        if (stmt->kind == STMT_FUNCTION) continue;
+        const Stmt* store = stmt->kind == STMT_FOR ? stmt->init : stmt;
+        if (store && store->kind == STMT_DECLARE) AddTypedName(table, store->name, store->type);
+        CollectTypedNames(table, &stmt->body);
+        CollectTypedNames(table, &stmt->else_body);
+    }
+}
+
+void FreeTypedNames(TypedNames* table) {
+    FreeNameTable(&table->names);
+    free(table->types);
+    memset(table, 0, sizeof(*table));
+}
+
+// The compiler's locals of a function: its parameters, of no fixed type,
+// then every declaration in its body
+void CollectLocals(TypedNames* table, const Stmt* function, const Block* body) {
+    FreeTypedNames(table);
+    for (int i = 0; i < function->param_count; i++) {
+        AddTypedName(table, function->params[i], TYPE_UNKNOWN);
+    }
+    CollectTypedNames(table, body);
+}
+
+// Runs pass on the top-level code, then on every function body
+typedef void (*BodyPass)(Program* program, Block* body, const Stmt* function, void* context);
+
+void RunOnBodies(Program* program, BodyPass pass, void* context) {
+    pass(program, &program->main, NULL, context);
+    for (int i = 0; i < program->main.count; i++) {
+        Stmt* stmt = program->main.items[i];
+        if (stmt->kind == STMT_FUNCTION) pass(program, &stmt->body, stmt, context);
+    }
+}
+
+// ---- constprop: variables that only ever hold their initial literal ----
+
+typedef struct {
+    const char* name;
+    VarType type;
+    Value value;
+} Constant;
+
+// The value a declaration of type stores for a literal, as StoreSlot would
+// convert it. Returns 0 when the store would be a type mismatch.
+int StoredLiteral(VarType type, const Expr* literal, Constant* constant) {
+    constant->type = literal->type;
+    constant->value = literal->value;
+    if (type == literal->type) return 1;
+    if (type == TYPE_FLOAT && literal->type == TYPE_INT) {
+        constant->type = TYPE_FLOAT;
+        constant->value.floatValue = (float)literal->value.intValue;
+        return 1;
+    }
+    return 0;
+}
+
+// Variables proven to hold a constant, by name
+typedef struct {
+    NameTable names;
+    Constant* values;
+} ConstantTable;
+
+void AddConstantName(ConstantTable* table, const Constant* constant) {
+    int id = InternName(&table->names, constant->name);
+    table->values = realloc(table->values, table->names.capacity * sizeof(Constant));
+    table->values[id] = *constant;
+}
+
+void ReplaceConstant(Expr* expr, void* context) {
+    const ConstantTable* table = context;
+    if (expr->kind != EXPR_VARIABLE) return;
+    int id = LookupName(&table->names, expr->name);
+    if (id < 0) return;
+    expr->kind = EXPR_LITERAL;
+    expr->type = table->values[id].type;
+    expr->value = table->values[id].value;
+}
+
+// A declaration at the top of the body with a literal value, that is the
+// only store to its variable anywhere, fixes the variable for every
+// statement after it. Those only run after the declaration has, unless a
+// goto before it jumps over it. Stores are counted once up front, and each
+// statement gets the constants declared before it in one visit.
+void PropagateBodyConstants(Program* program, Block* body, const Stmt* function, void* context) {
+    StoreCounts stores = {0};
+    // Functions can store to a global, not to another function's local
+    if (function) CountBlockStores(&stores, body, 0);
+    else CountBlockStores(&stores, &program->main, 1);
+    ConstantTable constants = {0};
+    int collecting = 1;
+    for (int i = 0; i < body->count; i++) {
+        Stmt* stmt = body->items[i];
+        if (constants.names.count > 0) VisitStatement(stmt, ReplaceConstant, &constants);
+        if (collecting && ContainsStatement(stmt, STMT_GOTO)) collecting = 0;
+        if (!collecting || stmt->kind != STMT_DECLARE) continue;
+        FoldExpression(stmt->expr);
+        if (stmt->expr->kind != EXPR_LITERAL || IsParameter(function, stmt->name)) continue;
+        Constant constant;
+        constant.name = stmt->name;
+        if (StoreCount(&stores, stmt->name) != 1 || !StoredLiteral(stmt->type, stmt->expr, &constant)) {
+            continue;
+        }
+        AddConstantName(&constants, &constant);
+    }
+    FreeStoreCounts(&stores);
+    FreeNameTable(&constants.names);
+    free(constants.values);
+}
+
+void PropagateConstants(Program* program) {
+    RunOnBodies(program, PropagateBodyConstants, NULL);
+    FoldProgram(program);
+}
+
+// ---- dce: unreachable statements and branches that never run ----
+
+typedef struct {
+    Program* program;
+    TypedNames globals;
+    TypedNames locals;          // Of the function being optimized
+    int in_function;
+    NameTable labels;           // Labels of the body being optimized
+} DeadCode;
+
+void CollectLabels(NameTable* labels, const Block* block) {
+    for (int i = 0; i < block->count; i++) {
+        const Stmt* stmt = block->items[i];
+        if (stmt->kind == STMT_FUNCTION) continue;
+        if (stmt->kind == STMT_LABEL) InternName(labels, stmt->name);
+        CollectLabels(labels, &stmt->body);
+        CollectLabels(labels, &stmt->else_body);
+    }
+}
+
+int CallCompiles(const DeadCode* dc, const char* name, int arg_count) {
+    Function* func = FindFunction(&dc->program->symbols, name);
+    return func && func->param_count == arg_count;
+}
+
+int ExpressionCompiles(const DeadCode* dc, const Expr* expr) {
+    if (expr == NULL) return 1;
+    if (expr->kind == EXPR_CALL && !CallCompiles(dc, expr->name, expr->arg_count)) return 0;
+    for (int i = 0; i < expr->arg_count; i++) {
+        if (!ExpressionCompiles(dc, expr->args[i])) return 0;
+    }
+    return ExpressionCompiles(dc, expr->left) && ExpressionCompiles(dc, expr->right);
+}
+
+int BlockCompiles(const DeadCode* dc, const Block* block);
+
+// Whether the compiler accepts stmt: the functions it calls exist and take
+// its arguments, the variables it stores to and the labels it jumps to
+// exist. A statement that fails must stay for its error to be reported.
+int StatementCompiles(const DeadCode* dc, const Stmt* stmt) {
+    if (stmt == NULL || stmt->kind == STMT_FUNCTION) return 1;
+    switch (stmt->kind) {
+        case STMT_ASSIGN:
+        case STMT_INPUT:
+            if (LookupName(&dc->globals.names, stmt->name) < 0 &&
+                !(dc->in_function && LookupName(&dc->locals.names, stmt->name) >= 0)) return 0;
+            break;
+        case STMT_GOTO:
+            if (LookupName(&dc->labels, stmt->name) < 0) return 0;
+            break;
+        case STMT_CALL:
+            if (!CallCompiles(dc, stmt->name, stmt->arg_count)) return 0;
+            break;
+        default:
+            break;
+    }
+    for (int i = 0; i < stmt->arg_count; i++) {
+        if (!ExpressionCompiles(dc, stmt->args[i])) return 0;
+    }
+    return ExpressionCompiles(dc, stmt->expr) && StatementCompiles(dc, stmt->init) &&
+           StatementCompiles(dc, stmt->increment) && BlockCompiles(dc, &stmt->body) &&
+           BlockCompiles(dc, &stmt->else_body);
+}
+
+int BlockCompiles(const DeadCode* dc, const Block* block) {
+    for (int i = 0; i < block->count; i++) {
+        if (!StatementCompiles(dc, block->items[i])) return 0;
+    }
+    return 1;
+}
+
+// Removing a statement must not drop a variable, which the compiler makes
+// for any declaration however unreachable, a label a goto lands on, or a
+// compile error
+int MustKeepStatement(const DeadCode* dc, const Stmt* stmt) {
+    return stmt->kind == STMT_FUNCTION || ContainsStatement(stmt, STMT_DECLARE) ||
+           ContainsStatement(stmt, STMT_LABEL) || !StatementCompiles(dc, stmt);
+}
+
+int MustKeepBlock(const DeadCode* dc, const Block* block) {
+    for (int i = 0; i < block->count; i++) {
+        if (MustKeepStatement(dc, block->items[i])) return 1;
+    }
+    return 0;
+}
+
+int IsBoolLiteral(const Expr* expr) {
+    return expr && expr->kind == EXPR_LITERAL && expr->type == TYPE_BOOL;
+}
+
+int EndsFlow(const Stmt* stmt) {
+    return stmt->kind == STMT_GOTO || stmt->kind == STMT_EXIT || stmt->kind == STMT_RETURN;
+}
+
+// Rebuilds block without the statements after a goto, exit or return up to
+// the next label, and with ifs and loops on a constant condition resolved
+void EliminateBlockDeadCode(const DeadCode* dc, Block* block) {
+    Arena* arena = &dc->program->arena;
+    Block kept = {0};
+    int unreachable = 0;
+    for (int i = 0; i < block->count; i++) {
+        Stmt* stmt = block->items[i];
+        if (unreachable && !MustKeepStatement(dc, stmt)) continue;
+        if (ContainsStatement(stmt, STMT_LABEL)) unreachable = 0;
+        if (stmt->kind != STMT_FUNCTION) {
+            EliminateBlockDeadCode(dc, &stmt->body);
+            EliminateBlockDeadCode(dc, &stmt->else_body);
+        }
+
+        if (stmt->kind == STMT_IF && IsBoolLiteral(stmt->expr)) {
+            Block* taken = stmt->expr->value.boolValue ? &stmt->body : &stmt->else_body;
+            Block* skipped = stmt->expr->value.boolValue ? &stmt->else_body : &stmt->body;
+            if (!MustKeepBlock(dc, skipped)) {
+                for (int j = 0; j < taken->count; j++) {
+                    AppendStmt(arena, &kept, taken->items[j]);
+                    if (EndsFlow(taken->items[j])) unreachable = 1;
+                }
+                continue;
+            }
+        }
+        if ((stmt->kind == STMT_WHILE || stmt->kind == STMT_FOR) && IsBoolLiteral(stmt->expr) &&
+            !stmt->expr->value.boolValue && !MustKeepBlock(dc, &stmt->body) &&
+            StatementCompiles(dc, stmt->increment)) {
+            // A for loop still runs its init clause
+            if (stmt->kind == STMT_FOR) AppendStmt(arena, &kept, stmt->init);
+            continue;
+        }
+        AppendStmt(arena, &kept, stmt);
+        if (EndsFlow(stmt)) unreachable = 1;
+    }
+    *block = kept;
+}
+
+void EliminateBodyDeadCode(Program* program, Block* body, const Stmt* function, void* context) {
+    DeadCode* dc = context;
+    dc->in_function = function != NULL;
+    ClearNameTable(&dc->labels);
+    CollectLabels(&dc->labels, body);
+    if (function) {
+        CollectLocals(&dc->locals, function, body);
+    }
+    EliminateBlockDeadCode(dc, body);
+}
+
+void EliminateDeadCode(Program* program) {
+    DeadCode dc = {0};
+    dc.program = program;
+    CollectTypedNames(&dc.globals, &program->main);
+    RunOnBodies(program, EliminateBodyDeadCode, &dc);
+    FreeTypedNames(&dc.globals);
+    FreeTypedNames(&dc.locals);
+    FreeNameTable(&dc.labels);
+}
+
+// ---- strength: x * 2 becomes x + x ----
+
+int IsIntLiteral(const Expr* expr, int value) {
+    return expr->kind == EXPR_LITERAL && expr->type == TYPE_INT && expr->value.intValue == value;
+}
+
+// x + x gives the same value as x * 2 for ints and floats and the same
+// error for anything else, and saves loading the constant. Larger powers
+// of two stay multiplications: the VM has no shift, and a multiply costs
+// no more than one.
+void ReduceMultiply(Expr* expr, void* context) {
+    Program* program = context;
+    if (expr->kind != EXPR_BINARY || expr->op != OPR_MUL) return;
+    Expr* variable = IsIntLiteral(expr->left, 2) ? expr->right : expr->left;
+    Expr* factor = variable == expr->left ? expr->right : expr->left;
+    if (variable->kind != EXPR_VARIABLE || !IsIntLiteral(factor, 2)) return;
+    Expr* copy = NewExpr(&program->arena, EXPR_VARIABLE);
+    strcpy(copy->name, variable->name);
+    copy->proven = variable->proven;
+    expr->op = OPR_ADD;
+    expr->left = variable;
+    expr->right = copy;
+}
+
+void ReduceBodyStrength(Program* program, Block* body, const Stmt* function, void* context) {
+    VisitBlock(body, ReduceMultiply, program);
+}
+
+void ReduceStrength(Program* program) {
+    RunOnBodies(program, ReduceBodyStrength, NULL);
+}
+
+// ---- licm: loop-invariant expressions computed once before the loop ----
+
+// An expression moved out of the loop into a temporary
+typedef struct {
+    Expr* expr;
+    char name[32];
+    VarType type;
+    unsigned int hash;          // Of expr, see HashExpression
+    int bucket;                 // Where the index holds it
+} Hoisted;
+
+typedef struct {
+    Program* program;
+    TypedNames globals;
+    TypedNames locals;          // Of the function being optimized
+    int in_function;
+    int structured;             // No labels, so code before a loop has run
+    unsigned char* ready;       // Locals known to hold a value of their
+    int ready_size;             // declared type, by id
+    int* declared;              // Ids set in ready: a stack, popped at the
+    int declared_count;         // end of the block that declared them
+    int declared_capacity;
+    const Stmt* loop;           // Loop being hoisted from, or NULL
+    const StoreCounts* loop_stores; // Stores to each name in the loop
+    int loop_calls;             // It calls functions, which may set globals
+    Hoisted* hoisted;
+    int hoisted_count;
+    int hoisted_capacity;
+    int* hoisted_index;         // Open-addressing index of hoisted by
+    int index_size;             // expression: entry + 1, 0 when empty
+    int temporaries;            // Temporaries made so far, for their names
+} Hoister;
+
+int IsValueType(VarType type) {
+    return type == TYPE_INT || type == TYPE_FLOAT || type == TYPE_BOOL;
+}
+
+int IsReady(const Hoister* h, int id) {
+    return id < h->ready_size && h->ready[id];
+}
+
+// Forgets the declarations made since the stack held mark entries
+void PopReady(Hoister* h, int mark) {
+    while (h->declared_count > mark) h->ready[h->declared[--h->declared_count]] = 0;
+}
+
+// Whether name holds a number or boolean that the loop does not change,
+// setting *type to its type. Globals always hold a value of their declared
+// type; locals only once a declaration has stored one.
+int StableVariable(const Hoister* h, const char* name, VarType* type) {
+    if (h->loop && StoreCount(h->loop_stores, name) > 0) return 0;
+    int id = h->in_function ? LookupName(&h->locals.names, name) : -1;
+    if (id >= 0) {
+        *type = h->locals.types[id];
+        return IsValueType(*type) && IsReady(h, id);
+    }
+    id = LookupName(&h->globals.names, name);
+    if (id < 0 || h->loop_calls) return 0;
+    *type = h->globals.types[id];
+    return IsValueType(*type);
+}
+
+// Whether expr can be computed before the loop: it has the same value on
+// every iteration and can never report an error, so computing it once, or
+// even when the loop body would not have, changes nothing. Sets *type to
+// the type of its value.
+int HoistableValue(const Hoister* h, const Expr* expr, VarType* type) {
+    VarType x, y;
+    switch (expr->kind) {
+        case EXPR_LITERAL:
+            *type = expr->type;
+            return 1;
+        case EXPR_VARIABLE:
+            return StableVariable(h, expr->name, type);
+        case EXPR_CALL:
+            return 0;
+        case EXPR_UNARY:
+            if (!HoistableValue(h, expr->left, &x)) return 0;
+            *type = x;
+            return expr->op == OPR_NOT ? x == TYPE_BOOL : IsNumericType(x);
+        case EXPR_BINARY:
+            if (!HoistableValue(h, expr->left, &x) || !HoistableValue(h, expr->right, &y)) return 0;
+            switch (expr->op) {
+                case OPR_AND:
+                case OPR_OR:
+                    *type = TYPE_BOOL;
+                    return x == TYPE_BOOL && y == TYPE_BOOL;
+                case OPR_EQ:
+                case OPR_NE:
+                case OPR_LT:
+                case OPR_GT:
+                case OPR_LE:
+                case OPR_GE:
+                    *type = TYPE_BOOL;
+                    return x == y && IsNumericType(x);
+                case OPR_DIV:
+                    // Only a constant divisor is known not to be zero
+                    if (expr->right->kind != EXPR_LITERAL) return 0;
+                    if (y == TYPE_INT && expr->right->value.intValue == 0) return 0;
+                    if (y == TYPE_FLOAT && expr->right->value.floatValue == 0.0f) return 0;
+                    // fall through
+                default:
+                    *type = x == TYPE_INT && y == TYPE_INT ? TYPE_INT : TYPE_FLOAT;
+                    return IsNumericType(x) && IsNumericType(y);
+            }
+    }
+    return 0;
+}
+
+// A declaration whose value always fits its variable makes the local ready
+void MarkReady(Hoister* h, const Stmt* stmt) {
+    if (!h->in_function || !h->structured) return;
+    int id = LookupName(&h->locals.names, stmt->name);
+    VarType declared = h->locals.types[id];
+    VarType type;
+    if (!IsValueType(declared) || !HoistableValue(h, stmt->expr, &type)) return;
+    if (type != declared && !(declared == TYPE_FLOAT && type == TYPE_INT)) return;
+    if (IsReady(h, id)) return;
+    if (id >= h->ready_size) {
+        int size = h->locals.names.capacity;
+        h->ready = realloc(h->ready, size);
+        memset(h->ready + h->ready_size, 0, size - h->ready_size);
+        h->ready_size = size;
+    }
+    if (h->declared_count >= h->declared_capacity) {
+        h->declared_capacity = h->declared_capacity ? h->declared_capacity * 2 : 16;
+        h->declared = realloc(h->declared, h->declared_capacity * sizeof(int));
+    }
+    h->ready[id] = 1;
+    h->declared[h->declared_count++] = id;
+}
+
+int SameExpression(const Expr* x, const Expr* y) {
+    if (x->kind != y->kind) return 0;
+    switch (x->kind) {
+        case EXPR_LITERAL:
+            return x->type == y->type && x->type != TYPE_STRING &&
+                   memcmp(&x->value, &y->value, sizeof(Value)) == 0;
+        case EXPR_VARIABLE:
+            return strcmp(x->name, y->name) == 0;
+        case EXPR_UNARY:
+            return x->op == y->op && SameExpression(x->left, y->left);
+        case EXPR_BINARY:
+            return x->op == y->op && SameExpression(x->left, y->left) && SameExpression(x->right, y->right);
+        default:
+            return 0;
+    }
+}
+
+// Equal expressions, as SameExpression sees them, hash the same
+unsigned int HashExpression(const Expr* expr) {
+    unsigned int hash = (2166136261u ^ expr->kind) * 16777619u;
+    switch (expr->kind) {
+        case EXPR_LITERAL:
+            return (hash ^ expr->type) * 16777619u ^ (unsigned int)expr->value.intValue;
+        case EXPR_VARIABLE:
+            return hash ^ HashName(expr->name);
+        case EXPR_UNARY:
+            return (hash ^ expr->op) * 16777619u ^ HashExpression(expr->left);
+        case EXPR_BINARY:
+            hash = ((hash ^ expr->op) * 16777619u ^ HashExpression(expr->left)) * 16777619u;
+            return hash ^ HashExpression(expr->right);
+        default:
+            return hash;
+    }
+}
+
+void IndexHoisted(Hoister* h, int entry) {
+    unsigned int mask = h->index_size - 1;
+    unsigned int i = h->hoisted[entry].hash & mask;
+    while (h->hoisted_index[i]) i = (i + 1) & mask;
+    h->hoisted_index[i] = entry + 1;
+    h->hoisted[entry].bucket = (int)i;
+}
+
+// The first hoisted expression equal to expr, or NULL
+Hoisted* FindHoisted(const Hoister* h, const Expr* expr, unsigned int hash) {
+    if (h->index_size == 0) return NULL;
+    unsigned int mask = h->index_size - 1;
+    for (unsigned int i = hash & mask; h->hoisted_index[i]; i = (i + 1) & mask) {
+        Hoisted* hoisted = &h->hoisted[h->hoisted_index[i] - 1];
+        if (hoisted->hash == hash && SameExpression(hoisted->expr, expr)) return hoisted;
+    }
+    return NULL;
+}
+
+Hoisted* AddHoisted(Hoister* h, Expr* expr) {
+    if (h->hoisted_count >= h->hoisted_capacity) {
+        h->hoisted_capacity = h->hoisted_capacity ? h->hoisted_capacity * 2 : 8;
+        h->hoisted = realloc(h->hoisted, h->hoisted_capacity * sizeof(Hoisted));
+    }
+    Hoisted* hoisted = &h->hoisted[h->hoisted_count++];
+    hoisted->expr = expr;
+    hoisted->hash = HashExpression(expr);
+    // Keep the load factor at or below one half
+    if (h->hoisted_count * 2 > h->index_size) {
+        h->index_size = h->index_size ? h->index_size * 2 : 32;
+        free(h->hoisted_index);
+        h->hoisted_index = calloc(h->index_size, sizeof(int));
+        for (int i = 0; i < h->hoisted_count; i++) IndexHoisted(h, i);
+    } else {
+        IndexHoisted(h, h->hoisted_count - 1);
+    }
+    return hoisted;
+}
+
+// Empties the hoisted list, clearing only the buckets it used
+void ClearHoisted(Hoister* h) {
+    for (int i = 0; i < h->hoisted_count; i++) h->hoisted_index[h->hoisted[i].bucket] = 0;
+    h->hoisted_count = 0;
+}
+
+// Turns expr into a read of the temporary holding its value, sharing one
+// temporary between equal expressions of the loop
+void ReplaceWithTemporary(Hoister* h, Expr* expr, VarType type) {
+    Hoisted* hoisted = FindHoisted(h, expr, HashExpression(expr));
+    if (hoisted == NULL) {
+        Expr* copy = NewExpr(&h->program->arena, expr->kind);
+        *copy = *expr;
+        hoisted = AddHoisted(h, copy);
+        hoisted->type = type;
+        // No script name can start with '$'
+        snprintf(hoisted->name, sizeof(hoisted->name), "$licm%d", h->temporaries++);
+    }
+    expr->kind = EXPR_VARIABLE;
+    strcpy(expr->name, hoisted->name);
+    expr->type = TYPE_UNKNOWN;
+    expr->left = NULL;
+    expr->right = NULL;
+}
+
+// Replaces the largest hoistable parts of expr. Lone literals and variables
+// are already as cheap as a temporary.
+void HoistFromExpression(Hoister* h, Expr* expr) {
+    if (expr == NULL) return;
+    VarType type;
+    if ((expr->kind == EXPR_UNARY || expr->kind == EXPR_BINARY) && HoistableValue(h, expr, &type)) {
+        ReplaceWithTemporary(h, expr, type);
+        return;
+    }
+    HoistFromExpression(h, expr->left);
+    HoistFromExpression(h, expr->right);
+    for (int i = 0; i < expr->arg_count; i++) HoistFromExpression(h, expr->args[i]);
+}
+
+void HoistFromBlock(Hoister* h, Block* block);
+
+void HoistFromStatement(Hoister* h, Stmt* stmt) {
+    if (stmt == NULL) return;
+    HoistFromExpression(h, stmt->expr);
+    for (int i = 0; i < stmt->arg_count; i++) HoistFromExpression(h, stmt->args[i]);
+    HoistFromStatement(h, stmt->init);
+    HoistFromStatement(h, stmt->increment);
+    HoistFromBlock(h, &stmt->body);
+    HoistFromBlock(h, &stmt->else_body);
+}
+
+// A temporary an inner loop declared moves out whole when its value is
+// invariant in this loop too, rather than being copied from a new one
+void HoistFromBlock(Hoister* h, Block* block) {
+    int kept = 0;
+    for (int i = 0; i < block->count; i++) {
+        Stmt* stmt = block->items[i];
+        VarType type;
+        if (stmt->kind == STMT_DECLARE && stmt->name[0] == '$' && HoistableValue(h, stmt->expr, &type)) {
+            Hoisted* hoisted = AddHoisted(h, stmt->expr);
+            hoisted->type = stmt->type;
+            strcpy(hoisted->name, stmt->name);
+            continue;
+        }
+        HoistFromStatement(h, stmt);
+        block->items[kept++] = stmt;
+    }
+    block->count = kept;
+}
+
+// Hoists out of the loop at block->items[index], declaring the temporaries
+// right before it. A loop with a label inside is left alone, a goto into it
+// would skip them. Returns the number of declarations added.
+int HoistLoop(Hoister* h, Block* block, int index) {
+    Stmt* loop = block->items[index];
+    if (BlockContainsStatement(&loop->body, STMT_LABEL)) return 0;
+    StoreCounts stores = {0};
+    CountStores(&stores, loop, 0);
+    h->loop = loop;
+    h->loop_stores = &stores;
+    h->loop_calls = StatementHasCall(loop);
+    ClearHoisted(h);
+    // The init clause already runs once
+    HoistFromExpression(h, loop->expr);
+    HoistFromBlock(h, &loop->body);
+    if (loop->increment) HoistFromExpression(h, loop->increment->expr);
+    h->loop = NULL;
+    h->loop_stores = NULL;
+    FreeStoreCounts(&stores);
+    h->loop_calls = 0;
+
+    for (int i = 0; i < h->hoisted_count; i++) {
+        Hoisted* hoisted = &h->hoisted[i];
+        Stmt* declare = NewStmt(&h->program->arena, STMT_DECLARE, loop->line);
+        strcpy(declare->name, hoisted->name);
+        declare->type = hoisted->type;
+        declare->expr = hoisted->expr;
+        InsertStmt(&h->program->arena, block, index + i, declare);
+        if (h->in_function) {
+            AddTypedName(&h->locals, declare->name, declare->type);
+            MarkReady(h, declare);
+        } else {
+            AddTypedName(&h->globals, declare->name, declare->type);
+        }
+    }
+    return h->hoisted_count;
+}
+
+// Inner loops are hoisted from first, so what they hoisted can move on out
+// of the loops around them
+void HoistBlock(Hoister* h, Block* block) {
+    int mark = h->declared_count;
+    for (int i = 0; i < block->count; i++) {
+        Stmt* stmt = block->items[i];
+        switch (stmt->kind) {
+            case STMT_DECLARE:
+                MarkReady(h, stmt);
+                break;
+            case STMT_IF:
+                HoistBlock(h, &stmt->body);
+                HoistBlock(h, &stmt->else_body);
+                break;
+            case STMT_WHILE:
+            case STMT_FOR:
+                HoistBlock(h, &stmt->body);
+                i += HoistLoop(h, block, i);
+                break;
+            default:
+                break;
+        }
+    }
+    PopReady(h, mark);
+}
+
+void HoistBodyInvariants(Program* program, Block* body, const Stmt* function, void* context) {
+    Hoister* h = context;
+    h->in_function = function != NULL;
+    h->structured = !BlockContainsStatement(body, STMT_LABEL);
+    PopReady(h, 0);
+    if (function) {
+        CollectLocals(&h->locals, function, body);
+    }
+    HoistBlock(h, body);
+}
+
+void HoistInvariants(Program* program) {
+    Hoister h = {0};
+    h.program = program;
+    CollectTypedNames(&h.globals, &program->main);
+    RunOnBodies(program, HoistBodyInvariants, &h);
+    FreeTypedNames(&h.globals);
+    FreeTypedNames(&h.locals);
+    free(h.ready);
+    free(h.declared);
+    free(h.hoisted);
+    free(h.hoisted_index);
+}
+
+// ---- The pass manager ----
+
+typedef struct {
+    const char* name;
+    int level;              // Lowest -O level that runs it
+    void (*run)(Program* program);
+} OptimizerPass;
+
+// In the order they run
+const OptimizerPass optimizer_passes[] = {
+    { "fold", 1, FoldProgram },
+    { "constprop", 1, PropagateConstants },
+    { "dce", 1, EliminateDeadCode },
+    { "strength", 2, ReduceStrength },
+    { "licm", 2, HoistInvariants },
+};
+
+#define OPTIMIZER_PASS_COUNT (int)(sizeof(optimizer_passes) / sizeof(optimizer_passes[0]))
+
+// Bit i of the result selects optimizer_passes[i]. Level 0 or below runs
+// no pass at all.
+unsigned int PassesForLevel(int level) {
+    unsigned int passes = 0;
+    for (int i = 0; i < OPTIMIZER_PASS_COUNT; i++) {
+        if (level >= optimizer_passes[i].level) passes |= 1u << i;
+    }
+    return passes;
+}
+
+// Parses a comma-separated list of pass names. Returns 0 after reporting
+// an unknown name.
+int ParsePassList(const char* list, unsigned int* passes) {
+    *passes = 0;
+    while (*list) {
+        size_t length = strcspn(list, ",");
+        int found = 0;
+        for (int i = 0; i < OPTIMIZER_PASS_COUNT && !found; i++) {
+            if (strlen(optimizer_passes[i].name) == length &&
+                strncmp(optimizer_passes[i].name, list, length) == 0) {
+                *passes |= 1u << i;
+                found = 1;
+            }
+        }
+        if (!found && length > 0) {
+            OutputFormat("Error: unknown optimization pass '%.*s'\n", (int)length, list);
+            return 0;
+        }
+        list += length;
+        if (*list == ',') list++;
+    }
+    return 1;
+}
+
+void OptimizeProgram(Program* program, unsigned int passes) {
+    for (int i = 0; i < OPTIMIZER_PASS_COUNT; i++) {
+        if (passes & (1u << i)) optimizer_passes[i].run(program);
+    }
+}
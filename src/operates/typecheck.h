@@ -0,0 +1,363 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include "../variable/symbol_table.h"
+#include "../parser/ast.h"
+#include "../commands/output.h"
+#include "optimize.h"
+
+// Static type checking of the whole program when it loads. Every
+// expression gets the one type its value can have; an operator or store
+// that can only fail with those types is reported before the script runs,
+// all of them at once. Parameters, call results and variables stored with
+// values of different types stay dynamic and are checked when they run.
+//
+// The checker also marks what it proves: Expr.proven is the type a node
+// always evaluates to, and Stmt.proven_store says a store always succeeds
+// without converting, so the compiler can leave out the runtime checks.
+
+// What the checker knows about the variables of one scope
+typedef struct {
+    TypedNames names;       // Declared types, from the first declaration
+    VarType* inferred;      // For names declared without a type, the type
+                            // every store gives them, TYPE_UNKNOWN if none
+    unsigned char* seen;    // A store to the name has been checked
+    unsigned char* assigned; // On the checker's assigned stack
+    int param_count;        // The first names are parameters
+} CheckScope;
+
+void InitCheckScope(CheckScope* scope, const Stmt* function, const Block* body) {
+    memset(scope, 0, sizeof(*scope));
+    if (function) {
+        CollectLocals(&scope->names, function, body);
+        scope->param_count = function->param_count;
+    } else {
+        CollectTypedNames(&scope->names, body);
+    }
+    int count = scope->names.names.count;
+    scope->inferred = calloc(count + 1, sizeof(VarType));
+    scope->seen = calloc(count + 1, 1);
+    scope->assigned = calloc(count + 1, 1);
+    for (int i = 0; i < count; i++) scope->inferred[i] = TYPE_UNKNOWN;
+}
+
+void FreeCheckScope(CheckScope* scope) {
+    FreeTypedNames(&scope->names);
+    free(scope->inferred);
+    free(scope->seen);
+    free(scope->assigned);
+}
+
+typedef struct {
+    CheckScope* scope;
+    int id;
+} AssignedName;
+
+typedef struct {
+    Program* program;
+    CheckScope globals;
+    CheckScope* functions;  // One per top-level function, in order
+    CheckScope* locals;     // Of the function being checked, NULL in main
+    int structured;         // No labels, so a store before has run
+    AssignedName* assigned; // Variables a store has set on every path to
+    int assigned_count;     // here: a stack, popped at the end of the block
+    int assigned_capacity;  // that stored them, each also flagged in its
+                            // scope so a lookup is one probe
+    int changed;            // An inferred type changed in this pass
+    int report;             // Report errors, in the last pass only
+    int errors;
+} TypeChecker;
+
+const char* const type_names[] = { "int", "float", "string", "bool", "unknown" };
+
+void TypeError(TypeChecker* tc, int line, const char* message) {
+    if (!tc->report) return;
+    OutputFormat("Error: line %d: %s\n", line, message);
+    tc->errors++;
+}
+
+void MarkAssigned(TypeChecker* tc, CheckScope* scope, int id) {
+    if (!tc->structured || scope->assigned[id]) return;
+    if (tc->assigned_count >= tc->assigned_capacity) {
+        tc->assigned_capacity = tc->assigned_capacity ? tc->assigned_capacity * 2 : 16;
+        tc->assigned = realloc(tc->assigned, tc->assigned_capacity * sizeof(*tc->assigned));
+    }
+    scope->assigned[id] = 1;
+    tc->assigned[tc->assigned_count].scope = scope;
+    tc->assigned[tc->assigned_count++].id = id;
+}
+
+// Forgets the stores made since the stack held mark entries
+void PopAssigned(TypeChecker* tc, int mark) {
+    while (tc->assigned_count > mark) {
+        AssignedName* name = &tc->assigned[--tc->assigned_count];
+        name->scope->assigned[name->id] = 0;
+    }
+}
+
+// Where a name lives, as the compiler resolves it: a local of the function
+// being checked, else a global. Returns NULL for an undeclared name.
+CheckScope* ResolveCheckScope(TypeChecker* tc, const char* name, int* id) {
+    if (tc->locals) {
+        *id = LookupName(&tc->locals->names.names, name);
+        if (*id >= 0) return tc->locals;
+    }
+    *id = LookupName(&tc->globals.names.names, name);
+    return *id >= 0 ? &tc->globals : NULL;
+}
+
+// A global with a declared type holds a value of that type from the start.
+// Any other variable holds nothing until its first store, and only a store
+// on every path to the read proves it holds a value.
+VarType VariableType(TypeChecker* tc, const char* name, int* proven) {
+    int id;
+    CheckScope* scope = ResolveCheckScope(tc, name, &id);
+    *proven = 0;
+    if (scope == NULL) {
+        // Undeclared names read as their own text
+        *proven = 1;
+        return TYPE_STRING;
+    }
+    if (id < scope->param_count) return TYPE_UNKNOWN;
+    VarType declared = scope->names.types[id];
+    if (declared != TYPE_UNKNOWN && scope == &tc->globals) {
+        *proven = 1;
+        return declared;
+    }
+    VarType type = declared != TYPE_UNKNOWN ? declared : scope->inferred[id];
+    // Functions cannot know whether the top-level code has set a global yet
+    *proven = type != TYPE_UNKNOWN && (scope == tc->locals || tc->locals == NULL) && scope->assigned[id];
+    return type;
+}
+
+VarType CheckExpression(TypeChecker* tc, Expr* expr, int line, int* proven);
+
+// Returns the type of a binary operator's value, TYPE_UNKNOWN after an error
+VarType CheckBinary(TypeChecker* tc, Expr* expr, int line, int* proven) {
+    int px, py;
+    VarType x = CheckExpression(tc, expr->left, line, &px);
+    VarType y = CheckExpression(tc, expr->right, line, &py);
+    *proven = px && py;
+    switch (expr->op) {
+        case OPR_AND:
+        case OPR_OR:
+            if ((x != TYPE_UNKNOWN && x != TYPE_BOOL) || (y != TYPE_UNKNOWN && y != TYPE_BOOL)) {
+                TypeError(tc, line, expr->op == OPR_AND ? "type mismatch for '&&' operator"
+                                                        : "type mismatch for '||' operator");
+                *proven = 0;
+                return TYPE_UNKNOWN;
+            }
+            return TYPE_BOOL;
+        case OPR_EQ:
+        case OPR_NE:
+        case OPR_LT:
+        case OPR_GT:
+        case OPR_LE:
+        case OPR_GE:
+            if ((x != TYPE_UNKNOWN && !IsNumericType(x)) || (y != TYPE_UNKNOWN && !IsNumericType(y)) ||
+                (x != TYPE_UNKNOWN && y != TYPE_UNKNOWN && x != y)) {
+                TypeError(tc, line, "type mismatch for comparison operator");
+                *proven = 0;
+                return TYPE_UNKNOWN;
+            }
+            return TYPE_BOOL;
+        default:
+            if ((x != TYPE_UNKNOWN && !IsNumericType(x)) || (y != TYPE_UNKNOWN && !IsNumericType(y))) {
+                TypeError(tc, line, "type mismatch for arithmetic operator");
+                *proven = 0;
+                return TYPE_UNKNOWN;
+            }
+            if (x == TYPE_UNKNOWN || y == TYPE_UNKNOWN) return TYPE_UNKNOWN;
+            // Division can still fail on a zero divisor
+            if (expr->op == OPR_DIV) {
+                const Expr* divisor = expr->right;
+                *proven = *proven && divisor->kind == EXPR_LITERAL &&
+                          (y == TYPE_INT ? divisor->value.intValue != 0 : divisor->value.floatValue != 0.0f);
+            }
+            return x == TYPE_INT && y == TYPE_INT ? TYPE_INT : TYPE_FLOAT;
+    }
+}
+
+// Returns the only type expr can evaluate to, TYPE_UNKNOWN if that is only
+// known when it runs. *proven is set when it always evaluates to that type
+// without an error.
+VarType CheckExpression(TypeChecker* tc, Expr* expr, int line, int* proven) {
+    VarType type = TYPE_UNKNOWN;
+    int px = 0;
+    *proven = 0;
+    switch (expr->kind) {
+        case EXPR_LITERAL:
+            type = expr->type;
+            *proven = 1;
+            break;
+        case EXPR_VARIABLE:
+            type = VariableType(tc, expr->name, proven);
+            break;
+        case EXPR_CALL:
+            for (int i = 0; i < expr->arg_count; i++) CheckExpression(tc, expr->args[i], line, &px);
+            break;
+        case EXPR_UNARY:
+            type = CheckExpression(tc, expr->left, line, &px);
+            if (expr->op == OPR_NOT ? type != TYPE_UNKNOWN && type != TYPE_BOOL
+                                    : type != TYPE_UNKNOWN && !IsNumericType(type)) {
+                TypeError(tc, line, expr->op == OPR_NOT ? "type mismatch for '!' operator"
+                                                        : "type mismatch for '-' operator");
+                type = TYPE_UNKNOWN;
+            }
+            *proven = px && type != TYPE_UNKNOWN;
+            break;
+        case EXPR_BINARY:
+            type = CheckBinary(tc, expr, line, proven);
+            break;
+    }
+    expr->proven = *proven ? type : TYPE_UNKNOWN;
+    return type;
+}
+
+void CheckCondition(TypeChecker* tc, Expr* expr, int line) {
+    int proven;
+    VarType type = CheckExpression(tc, expr, line, &proven);
+    if (type != TYPE_UNKNOWN && type != TYPE_BOOL) TypeError(tc, line, "condition must be boolean");
+}
+
+void CheckStore(TypeChecker* tc, Stmt* stmt) {
+    int proven;
+    VarType value = CheckExpression(tc, stmt->expr, stmt->line, &proven);
+    stmt->proven_store = 0;
+    int id;
+    CheckScope* scope = ResolveCheckScope(tc, stmt->name, &id);
+    // Stores to undeclared variables are the compiler's error
+    if (scope == NULL || id < scope->param_count) return;
+
+    VarType declared = scope->names.types[id];
+    if (declared != TYPE_UNKNOWN) {
+        if (value != TYPE_UNKNOWN && value != declared && !(declared == TYPE_FLOAT && value == TYPE_INT)) {
+            char message[128];
+            snprintf(message, sizeof(message), "cannot store %s in %s variable '%s'",
+                     type_names[value], type_names[declared], stmt->name);
+            TypeError(tc, stmt->line, message);
+            return;
+        }
+        stmt->proven_store = proven && value == declared && declared != TYPE_STRING;
+        if (proven) MarkAssigned(tc, scope, id);
+        return;
+    }
+
+    // Without a declared type the first store decides, so the variable has
+    // a type only if every store gives it the same one
+    VarType inferred = proven ? value : TYPE_UNKNOWN;
+    if (!scope->seen[id]) {
+        scope->seen[id] = 1;
+        scope->inferred[id] = inferred;
+        tc->changed = 1;
+    } else if (scope->inferred[id] != TYPE_UNKNOWN && scope->inferred[id] != inferred) {
+        scope->inferred[id] = TYPE_UNKNOWN;
+        tc->changed = 1;
+    }
+    VarType type = scope->inferred[id];
+    stmt->proven_store = type != TYPE_UNKNOWN && type != TYPE_STRING;
+    if (type != TYPE_UNKNOWN) MarkAssigned(tc, scope, id);
+}
+
+void CheckBlock(TypeChecker* tc, Block* block);
+
+// Checks a block whose stores only count inside it
+void CheckScopedBlock(TypeChecker* tc, Block* block) {
+    int mark = tc->assigned_count;
+    CheckBlock(tc, block);
+    PopAssigned(tc, mark);
+}
+
+void CheckStatement(TypeChecker* tc, Stmt* stmt) {
+    int proven;
+    switch (stmt->kind) {
+        case STMT_DECLARE:
+        case STMT_ASSIGN:
+            CheckStore(tc, stmt);
+            break;
+        case STMT_PRINT:
+            CheckExpression(tc, stmt->expr, stmt->line, &proven);
+            break;
+        case STMT_RETURN:
+            if (stmt->expr) CheckExpression(tc, stmt->expr, stmt->line, &proven);
+            break;
+        case STMT_CALL:
+            for (int i = 0; i < stmt->arg_count; i++) CheckExpression(tc, stmt->args[i], stmt->line, &proven);
+            break;
+        case STMT_IF:
+            CheckCondition(tc, stmt->expr, stmt->line);
+            CheckScopedBlock(tc, &stmt->body);
+            CheckScopedBlock(tc, &stmt->else_body);
+            break;
+        case STMT_WHILE:
+            CheckCondition(tc, stmt->expr, stmt->line);
+            CheckScopedBlock(tc, &stmt->body);
+            break;
+        case STMT_FOR:
+            // The init clause always runs, the increment after the body
+            CheckStore(tc, stmt->init);
+            CheckCondition(tc, stmt->expr, stmt->line);
+            CheckScopedBlock(tc, &stmt->body);
+            CheckStore(tc, stmt->increment);
+            break;
+        default:
+            break;
+    }
+}
+
+void CheckBlock(TypeChecker* tc, Block* block) {
+    for (int i = 0; i < block->count; i++) {
+        if (block->items[i]->kind != STMT_FUNCTION) CheckStatement(tc, block->items[i]);
+    }
+}
+
+void CheckBody(TypeChecker* tc, Block* body, CheckScope* locals) {
+    tc->locals = locals;
+    tc->structured = !BlockContainsStatement(body, STMT_LABEL);
+    PopAssigned(tc, 0);
+    CheckBlock(tc, body);
+}
+
+// One pass over the top-level code and every function
+void CheckPass(TypeChecker* tc) {
+    CheckBody(tc, &tc->program->main, NULL);
+    int function = 0;
+    for (int i = 0; i < tc->program->main.count; i++) {
+        Stmt* stmt = tc->program->main.items[i];
+        if (stmt->kind == STMT_FUNCTION) CheckBody(tc, &stmt->body, &tc->functions[function++]);
+    }
+}
+
+// Checks the program and marks what it proves. Returns the number of
+// errors, which have been reported.
+int CheckProgram(Program* program) {
+    TypeChecker tc = {0};
+    tc.program = program;
+    InitCheckScope(&tc.globals, NULL, &program->main);
+    int function_count = 0;
+    for (int i = 0; i < program->main.count; i++) {
+        function_count += program->main.items[i]->kind == STMT_FUNCTION;
+    }
+    tc.functions = calloc(function_count + 1, sizeof(CheckScope));
+    int function = 0;
+    for (int i = 0; i < program->main.count; i++) {
+        Stmt* stmt = program->main.items[i];
+        if (stmt->kind == STMT_FUNCTION) InitCheckScope(&tc.functions[function++], stmt, &stmt->body);
+    }
+
+    // Inferred types only ever go back to unknown, so this ends; once
+    // nothing changes every store agrees with them
+    do {
+        tc.changed = 0;
+        CheckPass(&tc);
+    } while (tc.changed);
+    tc.report = 1;
+    CheckPass(&tc);
+
+    FreeCheckScope(&tc.globals);
+    for (int i = 0; i < function_count; i++) FreeCheckScope(&tc.functions[i]);
+    free(tc.functions);
+    free(tc.assigned);
+    return tc.errors;
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include "../variable/symbol_table.h"
+#include "../memory/arena.h"
+
+typedef enum {
+    EXPR_LITERAL,
+    EXPR_VARIABLE,
+    EXPR_UNARY,
+    EXPR_BINARY,
+    EXPR_CALL
+} ExprKind;
+
+#define MAX_PARAMS 8
+
+typedef enum {
+    OPR_ADD,
+    OPR_SUB,
+    OPR_MUL,
+    OPR_DIV,
+    OPR_EQ,
+    OPR_NE,
+    OPR_LT,
+    OPR_GT,
+    OPR_LE,
+    OPR_GE,
+    OPR_AND,
+    OPR_OR,
+    OPR_NOT,
+    OPR_NEG
+} Operator;
+
+typedef struct Expr {
+    ExprKind kind;
+    Operator op;
+    VarType type;           // Literal type
+    Value value;            // Literal value
+    char name[32];          // Variable or function name
+    struct Expr* left;      // Operand of unary operators
+    struct Expr* right;
+    struct Expr** args;     // Call arguments
+    int arg_count;
+    VarType proven;         // Type the checker proved it always has
+} Expr;
+
+typedef enum {
+    STMT_DECLARE,
+    STMT_ASSIGN,
+    STMT_PRINT,
+    STMT_INPUT,
+    STMT_IF,
+    STMT_WHILE,
+    STMT_FOR,
+    STMT_GOTO,
+    STMT_LABEL,
+    STMT_CALL,
+    STMT_RETURN,
+    STMT_EXIT,
+    STMT_FUNCTION
+} StmtKind;
+
+typedef struct Block {
+    struct Stmt** items;
+    int count;
+    int capacity;
+} Block;
+
+typedef struct Stmt {
+    StmtKind kind;
+    int line;               // 1-based source line
+    char name[32];          // Variable, label or function name
+    VarType type;           // Declared type
+    Expr* expr;             // Value, condition or return value
+    Block body;             // Then branch, loop or function body
+    Block else_body;        // Else branch, an elseif is a nested if here
+    struct Stmt* init;      // for-loop clauses
+    struct Stmt* increment;
+    Expr** args;            // Call arguments
+    int arg_count;
+    char params[MAX_PARAMS][32]; // Function parameter names
+    int param_count;
+    char* text;             // Exit code
+    int proven_store;       // The checker proved the value always has the
+                            // variable's type, so storing needs no check
+} Stmt;
+
+// The whole tree, including literal strings, lives in the program's arena
+// and is released in one step
+typedef struct {
+    Block main;
+    int errors;
+    Arena arena;
+    SymbolTable symbols;    // Labels and functions declared in the script
+} Program;
+
+Expr* NewExpr(Arena* arena, ExprKind kind) {
+    Expr* expr = ArenaAlloc(arena, sizeof(Expr));
+    expr->kind = kind;
+    expr->type = TYPE_UNKNOWN;
+    expr->proven = TYPE_UNKNOWN;
+    return expr;
+}
+
+Stmt* NewStmt(Arena* arena, StmtKind kind, int line) {
+    Stmt* stmt = ArenaAlloc(arena, sizeof(Stmt));
+    stmt->kind = kind;
+    stmt->line = line;
+    stmt->type = TYPE_UNKNOWN;
+    return stmt;
+}
+
+void AppendStmt(Arena* arena, Block* block, Stmt* stmt) {
+    if (block->count >= block->capacity) {
+        int capacity = block->capacity ? block->capacity * 2 : 8;
+        block->items = ArenaGrow(arena, block->items, block->capacity * sizeof(Stmt*),
+                                 capacity * sizeof(Stmt*));
+        block->capacity = capacity;
+    }
+    block->items[block->count++] = stmt;
+}
+
+// Inserts stmt before the item at index
+void InsertStmt(Arena* arena, Block* block, int index, Stmt* stmt) {
+    AppendStmt(arena, block, stmt);
+    memmove(&block->items[index + 1], &block->items[index], (block->count - 1 - index) * sizeof(Stmt*));
+    block->items[index] = stmt;
+}
+
+void FreeProgram(Program* program) {
+    FreeArena(&program->arena);
+    FreeSymbolTable(&program->symbols);
+    free(program);
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "ast.h"
+#include "../commands/output.h"
+
+// Prints the tree back as script text, one statement per line prefixed
+// with its source line, for --dump-ir. Nested operators are parenthesized
+// so the grouping the optimizer sees is explicit.
+
+const char* const operator_texts[] = {
+    "+", "-", "*", "/", "==", "!=", "<", ">", "<=", ">=", "&&", "||", "!", "-"
+};
+
+const char* TypeKeyword(VarType type) {
+    switch (type) {
+        case TYPE_INT: return "int";
+        case TYPE_FLOAT: return "float";
+        case TYPE_STRING: return "string";
+        case TYPE_BOOL: return "bool";
+        default: return NULL;
+    }
+}
+
+void DumpExpression(const Expr* expr, int nested) {
+    char text[64];
+    switch (expr->kind) {
+        case EXPR_LITERAL:
+            if (expr->type == TYPE_INT) {
+                OutputBytes(text, FormatInt(expr->value.intValue, text));
+            } else if (expr->type == TYPE_FLOAT) {
+                OutputBytes(text, FormatFloat(expr->value.floatValue, text));
+            } else if (expr->type == TYPE_BOOL) {
+                OutputText(expr->value.boolValue ? "true" : "false");
+            } else {
+                OutputFormat("\"%s\"", expr->value.stringValue->chars);
+            }
+            return;
+        case EXPR_VARIABLE:
+            OutputText(expr->name);
+            return;
+        case EXPR_CALL:
+            OutputFormat("%s(", expr->name);
+            for (int i = 0; i < expr->arg_count; i++) {
+                if (i > 0) OutputText(", ");
+                DumpExpression(expr->args[i], 0);
+            }
+            OutputText(")");
+            return;
+        case EXPR_UNARY:
+            OutputText(operator_texts[expr->op]);
+            DumpExpression(expr->left, 1);
+            return;
+        case EXPR_BINARY:
+            if (nested) OutputText("(");
+            DumpExpression(expr->left, 1);
+            OutputFormat(" %s ", operator_texts[expr->op]);
+            DumpExpression(expr->right, 1);
+            if (nested) OutputText(")");
+            return;
+    }
+}
+
+// A store without its line prefix, as in a for clause
+void DumpStore(const Stmt* stmt) {
+    const char* keyword = stmt->kind == STMT_DECLARE ? TypeKeyword(stmt->type) : NULL;
+    if (keyword) OutputFormat("%s ", keyword);
+    OutputFormat("%s = ", stmt->name);
+    DumpExpression(stmt->expr, 0);
+}
+
+void DumpLine(int line, int depth) {
+    OutputFormat("%4d  %*s", line, depth * 4, "");
+}
+
+void DumpBlock(const Block* block, int depth);
+
+void DumpStatement(const Stmt* stmt, int depth) {
+    DumpLine(stmt->line, depth);
+    switch (stmt->kind) {
+        case STMT_DECLARE:
+        case STMT_ASSIGN:
+            DumpStore(stmt);
+            break;
+        case STMT_PRINT:
+            OutputText("print ");
+            DumpExpression(stmt->expr, 0);
+            break;
+        case STMT_INPUT:
+            OutputFormat("input %s", stmt->name);
+            break;
+        case STMT_IF:
+            OutputText("if ");
+            DumpExpression(stmt->expr, 0);
+            OutputNewline();
+            DumpBlock(&stmt->body, depth + 1);
+            if (stmt->else_body.count > 0) {
+                DumpLine(stmt->line, depth);
+                OutputText("else\n");
+                DumpBlock(&stmt->else_body, depth + 1);
+            }
+            DumpLine(stmt->line, depth);
+            OutputText("endif");
+            break;
+        case STMT_WHILE:
+            OutputText("while ");
+            DumpExpression(stmt->expr, 0);
+            OutputNewline();
+            DumpBlock(&stmt->body, depth + 1);
+            DumpLine(stmt->line, depth);
+            OutputText("endwhile");
+            break;
+        case STMT_FOR:
+            OutputText("for (");
+            DumpStore(stmt->init);
+            OutputText("; ");
+            DumpExpression(stmt->expr, 0);
+            OutputText("; ");
+            DumpStore(stmt->increment);
+            OutputText(")\n");
+            DumpBlock(&stmt->body, depth + 1);
+            DumpLine(stmt->line, depth);
+            OutputText("endfor");
+            break;
+        case STMT_GOTO:
+            OutputFormat("goto %s", stmt->name);
+            break;
+        case STMT_LABEL:
+            OutputFormat("%s:", stmt->name);
+            break;
+        case STMT_CALL:
+            OutputFormat("%s(", stmt->name);
+            for (int i = 0; i < stmt->arg_count; i++) {
+                if (i > 0) OutputText(", ");
+                DumpExpression(stmt->args[i], 0);
+            }
+            OutputText(")");
+            break;
+        case STMT_RETURN:
+            OutputText("return");
+            if (stmt->expr) {
+                OutputText(" ");
+                DumpExpression(stmt->expr, 0);
+            }
+            break;
+        case STMT_EXIT:
+            OutputFormat("exit %s", stmt->text);
+            break;
+        case STMT_FUNCTION:
+            OutputFormat("function %s(", stmt->name);
+            for (int i = 0; i < stmt->param_count; i++) {
+                OutputFormat(i > 0 ? ", %s" : "%s", stmt->params[i]);
+            }
+            OutputText(") {\n");
+            DumpBlock(&stmt->body, depth + 1);
+            DumpLine(stmt->line, depth);
+            OutputText("}");
+            break;
+    }
+    OutputNewline();
+}
+
+void DumpBlock(const Block* block, int depth) {
+    for (int i = 0; i < block->count; i++) {
+        DumpStatement(block->items[i], depth);
+    }
+}
+
+void DumpProgram(const Program* program) {
+    DumpBlock(&program->main, 0);
+}
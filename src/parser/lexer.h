@@ -0,0 +1,166 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+typedef enum {
+    TOK_END,        // End of line
+    TOK_IDENT,
+    TOK_INT,
+    TOK_FLOAT,
+    TOK_STRING,
+    TOK_LPAREN,
+    TOK_RPAREN,
+    TOK_LBRACE,
+    TOK_RBRACE,
+    TOK_COMMA,
+    TOK_SEMICOLON,
+    TOK_COLON,
+    TOK_ASSIGN,
+    TOK_PLUS,
+    TOK_MINUS,
+    TOK_STAR,
+    TOK_SLASH,
+    TOK_EQ,
+    TOK_NE,
+    TOK_LT,
+    TOK_GT,
+    TOK_LE,
+    TOK_GE,
+    TOK_AND,
+    TOK_OR,
+    TOK_NOT,
+    TOK_ERROR
+} TokenKind;
+
+// A token is a view into the source line, nothing is copied
+typedef struct {
+    TokenKind kind;
+    const char* start;
+    int length;
+} Token;
+
+typedef struct {
+    Token* tokens;
+    int count;
+    int capacity;
+} TokenList;
+
+void PushToken(TokenList* list, TokenKind kind, const char* start, int length) {
+    if (list->count >= list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        list->tokens = realloc(list->tokens, list->capacity * sizeof(Token));
+    }
+    Token* tok = &list->tokens[list->count++];
+    tok->kind = kind;
+    tok->start = start;
+    tok->length = length;
+}
+
+int TokenIs(const Token* tok, const char* text) {
+    return (int)strlen(text) == tok->length && strncmp(tok->start, text, tok->length) == 0;
+}
+
+// Copies the token text into a fixed-size name buffer
+void TokenName(const Token* tok, char* out, int size) {
+    int len = tok->length < size - 1 ? tok->length : size - 1;
+    memcpy(out, tok->start, len);
+    out[len] = '\0';
+}
+
+// Splits one line into tokens, always terminated by TOK_END. A "//" starts
+// a comment that runs to the end of the line.
+void LexLine(const char* text, int length, TokenList* out) {
+    out->count = 0;
+    int i = 0;
+    while (i < length) {
+        char c = text[i];
+        if (c == ' ' || c == '\t' || c == '\r') {
+            i++;
+            continue;
+        }
+        if (c == '/' && i + 1 < length && text[i+1] == '/') {
+            break;
+        }
+
+        int start = i;
+        if (isalpha((unsigned char)c) || c == '_') {
+            while (i < length && (isalnum((unsigned char)text[i]) || text[i] == '_')) i++;
+            PushToken(out, TOK_IDENT, text + start, i - start);
+            continue;
+        }
+        if (isdigit((unsigned char)c) ||
+            (c == '.' && i + 1 < length && isdigit((unsigned char)text[i+1]))) {
+            TokenKind kind = TOK_INT;
+            while (i < length && isdigit((unsigned char)text[i])) i++;
+            if (i < length && text[i] == '.') {
+                kind = TOK_FLOAT;
+                i++;
+                while (i < length && isdigit((unsigned char)text[i])) i++;
+            }
+            PushToken(out, kind, text + start, i - start);
+            continue;
+        }
+        if (c == '"') {
+            i++;
+            while (i < length && text[i] != '"') {
+                if (text[i] == '\\' && i + 1 < length) i++;
+                i++;
+            }
+            if (i >= length) {
+                PushToken(out, TOK_ERROR, text + start, i - start);
+                break;
+            }
+            i++;
+            PushToken(out, TOK_STRING, text + start, i - start);
+            continue;
+        }
+
+        char next = i + 1 < length ? text[i+1] : '\0';
+        TokenKind kind = TOK_ERROR;
+        int width = 1;
+        switch (c) {
+            case '(': kind = TOK_LPAREN; break;
+            case ')': kind = TOK_RPAREN; break;
+            case '{': kind = TOK_LBRACE; break;
+            case '}': kind = TOK_RBRACE; break;
+            case ',': kind = TOK_COMMA; break;
+            case ';': kind = TOK_SEMICOLON; break;
+            case ':': kind = TOK_COLON; break;
+            case '+': kind = TOK_PLUS; break;
+            case '-': kind = TOK_MINUS; break;
+            case '*': kind = TOK_STAR; break;
+            case '/': kind = TOK_SLASH; break;
+            case '=':
+                if (next == '=') { kind = TOK_EQ; width = 2; }
+                else kind = TOK_ASSIGN;
+                break;
+            case '!':
+                if (next == '=') { kind = TOK_NE; width = 2; }
+                else kind = TOK_NOT;
+                break;
+            case '<':
+                if (next == '=') { kind = TOK_LE; width = 2; }
+                else kind = TOK_LT;
+                break;
+            case '>':
+                if (next == '=') { kind = TOK_GE; width = 2; }
+                else kind = TOK_GT;
+                break;
+            case '&':
+                if (next == '&') { kind = TOK_AND; width = 2; }
+                break;
+            case '|':
+                if (next == '|') { kind = TOK_OR; width = 2; }
+                break;
+            default:
+                break;
+        }
+        PushToken(out, kind, text + start, width);
+        i += width;
+    }
+    PushToken(out, TOK_END, text + length, 0);
+    out->count--;   // TOK_END is a sentinel, not counted
+}
@@ -0,0 +1,642 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "../variable/symbol_table.h"
+#include "../commands/output.h"
+#include "lexer.h"
+#include "ast.h"
+#include "../proccess_command/source.h"
+
+typedef struct {
+    const LineView* lines;
+    int line_count;
+    int line;               // Current line index
+    int lexed_line;         // Line currently held in toks
+    TokenList toks;
+    int pos;
+    int quiet;              // Suppresses errors while trying a parse
+    int in_function;
+    Program* program;
+    Arena* arena;           // Where the tree is allocated
+} Parser;
+
+void ParseError(Parser* p, const char* message, const char* detail) {
+    if (p->quiet) {
+        p->program->errors++;
+        return;
+    }
+    if (detail) {
+        OutputFormat("Error: line %d: %s '%s'\n", p->line + 1, message, detail);
+    } else {
+        OutputFormat("Error: line %d: %s\n", p->line + 1, message);
+    }
+    p->program->errors++;
+}
+
+void LexCurrentLine(Parser* p) {
+    if (p->lexed_line == p->line) return;
+    LexLine(p->lines[p->line].start, p->lines[p->line].length, &p->toks);
+    p->lexed_line = p->line;
+    p->pos = 0;
+}
+
+Token* Tok(Parser* p, int index) {
+    return &p->toks.tokens[index < p->toks.count ? index : p->toks.count];
+}
+
+int AtLineEnd(Parser* p) {
+    return p->pos >= p->toks.count;
+}
+
+// End of a block header, ignoring the optional trailing '{'
+int HeaderEnd(Parser* p) {
+    int end = p->toks.count;
+    if (end > p->pos && Tok(p, end - 1)->kind == TOK_LBRACE) end--;
+    return end;
+}
+
+// Finds the ')' matching the '(' at index, or -1
+int MatchingParen(Parser* p, int index, int end) {
+    int depth = 0;
+    for (int i = index; i < end; i++) {
+        if (Tok(p, i)->kind == TOK_LPAREN) depth++;
+        else if (Tok(p, i)->kind == TOK_RPAREN && --depth == 0) return i;
+    }
+    return -1;
+}
+
+VarType TypeFromKeyword(const Token* tok) {
+    if (TokenIs(tok, "int")) return TYPE_INT;
+    if (TokenIs(tok, "float")) return TYPE_FLOAT;
+    if (TokenIs(tok, "string")) return TYPE_STRING;
+    if (TokenIs(tok, "bool")) return TYPE_BOOL;
+    return TYPE_UNKNOWN;
+}
+
+String* UnescapeString(Parser* p, const Token* tok) {
+    String* out = ArenaAlloc(p->arena, sizeof(String) + tok->length);
+    out->refcount = 1;
+    int n = 0;
+    for (int i = 1; i < tok->length - 1; i++) {
+        char c = tok->start[i];
+        if (c == '\\' && i + 1 < tok->length - 1) {
+            c = tok->start[++i];
+            if (c == 'n') c = '\n';
+            else if (c == 't') c = '\t';
+        }
+        out->chars[n++] = c;
+    }
+    SealString(out, n);
+    return out;
+}
+
+// Copies a numeric token into buf so it can be converted; lines are views
+// into the script and are not NUL-terminated
+const char* TokenNumber(const Token* tok, char* buf, int size) {
+    int length = tok->length < size - 1 ? tok->length : size - 1;
+    memcpy(buf, tok->start, length);
+    buf[length] = '\0';
+    return buf;
+}
+
+Expr* ParseOperand(Parser* p, const Token* tok) {
+    char number[64];
+    Expr* expr = NewExpr(p->arena, EXPR_LITERAL);
+    switch (tok->kind) {
+        case TOK_INT:
+            expr->type = TYPE_INT;
+            expr->value.intValue = (int)strtol(TokenNumber(tok, number, sizeof(number)), NULL, 10);
+            return expr;
+        case TOK_FLOAT:
+            expr->type = TYPE_FLOAT;
+            expr->value.floatValue = strtof(TokenNumber(tok, number, sizeof(number)), NULL);
+            return expr;
+        case TOK_STRING:
+            expr->type = TYPE_STRING;
+            expr->value.stringValue = UnescapeString(p, tok);
+            return expr;
+        case TOK_IDENT:
+            if (TokenIs(tok, "true") || TokenIs(tok, "false")) {
+                expr->type = TYPE_BOOL;
+                expr->value.boolValue = TokenIs(tok, "true");
+                return expr;
+            }
+            expr->kind = EXPR_VARIABLE;
+            TokenName(tok, expr->name, sizeof(expr->name));
+            return expr;
+        default:
+            ParseError(p, "Unexpected token in expression", NULL);
+            return NULL;
+    }
+}
+
+// Binding strength of a binary operator token, 0 for anything else
+int BinaryPrecedence(TokenKind kind) {
+    switch (kind) {
+        case TOK_OR: return 1;
+        case TOK_AND: return 2;
+        case TOK_EQ: case TOK_NE: case TOK_LT:
+        case TOK_GT: case TOK_LE: case TOK_GE: return 3;
+        case TOK_PLUS: case TOK_MINUS: return 4;
+        case TOK_STAR: case TOK_SLASH: return 5;
+        default: return 0;
+    }
+}
+
+Operator OperatorFromToken(TokenKind kind) {
+    switch (kind) {
+        case TOK_PLUS: return OPR_ADD;
+        case TOK_MINUS: return OPR_SUB;
+        case TOK_STAR: return OPR_MUL;
+        case TOK_SLASH: return OPR_DIV;
+        case TOK_EQ: return OPR_EQ;
+        case TOK_NE: return OPR_NE;
+        case TOK_LT: return OPR_LT;
+        case TOK_GT: return OPR_GT;
+        case TOK_LE: return OPR_LE;
+        case TOK_GE: return OPR_GE;
+        case TOK_AND: return OPR_AND;
+        default: return OPR_OR;
+    }
+}
+
+Expr* ParseBinary(Parser* p, int* pos, int end, int min_precedence);
+Expr* ParseExpressionRange(Parser* p, int start, int end);
+
+// Parses the comma-separated arguments between the parentheses at open and
+// close
+Expr** ParseArguments(Parser* p, int open, int close, int* count) {
+    Expr** args = NULL;
+    *count = 0;
+    if (close == open + 1) return NULL;
+    int i = open + 1;
+    for (;;) {
+        int depth = 0;
+        int j = i;
+        while (j < close && (depth > 0 || Tok(p, j)->kind != TOK_COMMA)) {
+            if (Tok(p, j)->kind == TOK_LPAREN) depth++;
+            else if (Tok(p, j)->kind == TOK_RPAREN) depth--;
+            j++;
+        }
+        args = ArenaGrow(p->arena, args, *count * sizeof(Expr*), (*count + 1) * sizeof(Expr*));
+        args[(*count)++] = ParseExpressionRange(p, i, j);
+        if (j >= close) return args;
+        i = j + 1;
+    }
+}
+
+// Parses a prefix operator, a parenthesized expression or a single operand
+// starting at *pos
+Expr* ParseUnary(Parser* p, int* pos, int end) {
+    if (*pos >= end) {
+        ParseError(p, "Expected expression", NULL);
+        return NULL;
+    }
+
+    const Token* tok = Tok(p, *pos);
+    if (tok->kind == TOK_NOT || tok->kind == TOK_MINUS) {
+        const Token* next = Tok(p, *pos + 1);
+        (*pos)++;
+        // A minus sign directly before a number is part of the literal
+        if (tok->kind == TOK_MINUS && *pos < end &&
+            (next->kind == TOK_INT || next->kind == TOK_FLOAT)) {
+            Expr* literal = ParseOperand(p, next);
+            if (literal->type == TYPE_INT) literal->value.intValue = -literal->value.intValue;
+            else literal->value.floatValue = -literal->value.floatValue;
+            (*pos)++;
+            return literal;
+        }
+        Expr* operand = ParseUnary(p, pos, end);
+        if (operand == NULL) return NULL;
+        Expr* expr = NewExpr(p->arena, EXPR_UNARY);
+        expr->op = tok->kind == TOK_NOT ? OPR_NOT : OPR_NEG;
+        expr->left = operand;
+        return expr;
+    }
+
+    if (tok->kind == TOK_LPAREN) {
+        int close = MatchingParen(p, *pos, end);
+        if (close < 0) {
+            ParseError(p, "Unbalanced parentheses", NULL);
+            return NULL;
+        }
+        int inner = *pos + 1;
+        Expr* expr = ParseBinary(p, &inner, close, 1);
+        if (expr != NULL && inner != close) {
+            ParseError(p, "Unsupported expression format", NULL);
+            return NULL;
+        }
+        *pos = close + 1;
+        return expr;
+    }
+
+    // Function call
+    if (tok->kind == TOK_IDENT && *pos + 1 < end && Tok(p, *pos + 1)->kind == TOK_LPAREN) {
+        int close = MatchingParen(p, *pos + 1, end);
+        if (close < 0) {
+            ParseError(p, "Unbalanced parentheses", NULL);
+            return NULL;
+        }
+        Expr* call = NewExpr(p->arena, EXPR_CALL);
+        TokenName(tok, call->name, sizeof(call->name));
+        call->args = ParseArguments(p, *pos + 1, close, &call->arg_count);
+        for (int i = 0; i < call->arg_count; i++) {
+            if (call->args[i] == NULL) return NULL;
+        }
+        *pos = close + 1;
+        return call;
+    }
+
+    (*pos)++;
+    return ParseOperand(p, tok);
+}
+
+// Precedence climbing: parses operands joined by binary operators that bind
+// at least as tightly as min_precedence. Operators of equal precedence group
+// to the left.
+Expr* ParseBinary(Parser* p, int* pos, int end, int min_precedence) {
+    Expr* left = ParseUnary(p, pos, end);
+    while (left != NULL && *pos < end) {
+        TokenKind kind = Tok(p, *pos)->kind;
+        int precedence = BinaryPrecedence(kind);
+        if (precedence == 0 || precedence < min_precedence) break;
+        (*pos)++;
+
+        Expr* right = ParseBinary(p, pos, end, precedence + 1);
+        if (right == NULL) return NULL;
+        Expr* expr = NewExpr(p->arena, EXPR_BINARY);
+        expr->op = OperatorFromToken(kind);
+        expr->left = left;
+        expr->right = right;
+        left = expr;
+    }
+    return left;
+}
+
+// Builds an expression tree from tokens [start, end)
+Expr* ParseExpressionRange(Parser* p, int start, int end) {
+    int pos = start;
+    Expr* expr = ParseBinary(p, &pos, end, 1);
+    if (expr != NULL && pos != end) {
+        ParseError(p, "Unsupported expression format", NULL);
+        return NULL;
+    }
+    return expr;
+}
+
+Stmt* ParseStatement(Parser* p);
+
+typedef enum {
+    BLOCK_END_OF_FILE,
+    BLOCK_TERMINATOR,       // Stopped before one of the terminator keywords
+    BLOCK_CLOSED            // Consumed the '}' closing a function body
+} BlockEnd;
+
+// Parses statements into block until a terminator keyword or, for function
+// bodies, the closing '}'. A '}' at the start of a line inside if/while/for
+// bodies only closes the brace opened by the header and is skipped.
+BlockEnd ParseBlock(Parser* p, Block* block, const char* const* terminators, int closes_on_brace) {
+    while (p->line < p->line_count) {
+        LexCurrentLine(p);
+        if (AtLineEnd(p)) {
+            p->line++;
+            continue;
+        }
+
+        if (Tok(p, p->pos)->kind == TOK_RBRACE) {
+            p->pos++;
+            if (closes_on_brace) {
+                if (!AtLineEnd(p)) ParseError(p, "Unexpected tokens after '}'", NULL);
+                p->line++;
+                return BLOCK_CLOSED;
+            }
+            if (AtLineEnd(p)) {
+                p->line++;
+                continue;
+            }
+        }
+
+        const Token* first = Tok(p, p->pos);
+        for (int i = 0; terminators && terminators[i]; i++) {
+            if (first->kind == TOK_IDENT && TokenIs(first, terminators[i])) {
+                return BLOCK_TERMINATOR;
+            }
+        }
+
+        Stmt* stmt = ParseStatement(p);
+        if (stmt) AppendStmt(p->arena, block, stmt);
+    }
+    return BLOCK_END_OF_FILE;
+}
+
+// Parses "name = expr" or "type name = expr" from tokens [start, end)
+Stmt* ParseStore(Parser* p, int start, int end) {
+    int pos = start;
+    VarType type = TYPE_UNKNOWN;
+    if (pos < end && Tok(p, pos)->kind == TOK_IDENT) {
+        type = TypeFromKeyword(Tok(p, pos));
+        if (type != TYPE_UNKNOWN) pos++;
+    }
+    if (pos + 2 > end || Tok(p, pos)->kind != TOK_IDENT || Tok(p, pos + 1)->kind != TOK_ASSIGN) {
+        ParseError(p, "Syntax error", NULL);
+        return NULL;
+    }
+
+    Stmt* stmt = NewStmt(p->arena, type == TYPE_UNKNOWN ? STMT_ASSIGN : STMT_DECLARE, p->line + 1);
+    stmt->type = type;
+    TokenName(Tok(p, pos), stmt->name, sizeof(stmt->name));
+    stmt->expr = ParseExpressionRange(p, pos + 2, end);
+    return stmt->expr ? stmt : NULL;
+}
+
+Stmt* ParseIf(Parser* p) {
+    static const char* const terminators[] = { "elseif", "else", "endif", NULL };
+    Stmt* stmt = NewStmt(p->arena, STMT_IF, p->line + 1);
+    Stmt* branch = stmt;
+    int start_line = p->line;
+
+    for (;;) {
+        int end = HeaderEnd(p);
+        if (end <= p->pos + 1) {
+            ParseError(p, "Syntax error: if requires condition", NULL);
+        } else {
+            branch->expr = ParseExpressionRange(p, p->pos + 1, end);
+        }
+        p->line++;
+
+        if (ParseBlock(p, &branch->body, terminators, 0) == BLOCK_END_OF_FILE) {
+            p->line = start_line;
+            ParseError(p, "Missing endif for if statement", NULL);
+            p->line = p->line_count;
+            return stmt;
+        }
+
+        const Token* keyword = Tok(p, p->pos);
+        if (TokenIs(keyword, "elseif")) {
+            Stmt* next = NewStmt(p->arena, STMT_IF, p->line + 1);
+            AppendStmt(p->arena, &branch->else_body, next);
+            branch = next;
+            continue;
+        }
+        if (TokenIs(keyword, "else")) {
+            p->line++;
+            if (ParseBlock(p, &branch->else_body, terminators, 0) == BLOCK_END_OF_FILE ||
+                !TokenIs(Tok(p, p->pos), "endif")) {
+                ParseError(p, "Missing endif for if statement", NULL);
+            }
+        }
+        // Positioned on endif
+        p->line++;
+        return stmt;
+    }
+}
+
+Stmt* ParseWhile(Parser* p) {
+    static const char* const terminators[] = { "endwhile", NULL };
+    Stmt* stmt = NewStmt(p->arena, STMT_WHILE, p->line + 1);
+    int start_line = p->line;
+
+    int end = HeaderEnd(p);
+    if (end <= p->pos + 1) {
+        ParseError(p, "Syntax error: while requires condition", NULL);
+    } else {
+        stmt->expr = ParseExpressionRange(p, p->pos + 1, end);
+    }
+    p->line++;
+
+    if (ParseBlock(p, &stmt->body, terminators, 0) == BLOCK_END_OF_FILE) {
+        p->line = start_line;
+        ParseError(p, "Missing endwhile for while loop", NULL);
+        p->line = p->line_count;
+        return stmt;
+    }
+    p->line++;
+    return stmt;
+}
+
+Stmt* ParseFor(Parser* p) {
+    static const char* const terminators[] = { "endfor", NULL };
+    Stmt* stmt = NewStmt(p->arena, STMT_FOR, p->line + 1);
+    int start_line = p->line;
+
+    // for ( init ; condition ; increment )
+    int open = p->pos + 1;
+    int close = Tok(p, open)->kind == TOK_LPAREN ? MatchingParen(p, open, p->toks.count) : -1;
+    int first_semi = -1, second_semi = -1;
+    for (int i = open + 1; close != -1 && i < close; i++) {
+        if (Tok(p, i)->kind != TOK_SEMICOLON) continue;
+        if (first_semi == -1) first_semi = i;
+        else if (second_semi == -1) second_semi = i;
+    }
+    if (second_semi == -1 || close != HeaderEnd(p) - 1) {
+        ParseError(p, "Syntax error: for(init; condition; increment)", NULL);
+    } else {
+        stmt->init = ParseStore(p, open + 1, first_semi);
+        // The loop variable may be introduced by the init clause
+        if (stmt->init && stmt->init->kind == STMT_ASSIGN) {
+            stmt->init->kind = STMT_DECLARE;
+        }
+        stmt->expr = ParseExpressionRange(p, first_semi + 1, second_semi);
+        stmt->increment = ParseStore(p, second_semi + 1, close);
+    }
+    p->line++;
+
+    if (ParseBlock(p, &stmt->body, terminators, 0) == BLOCK_END_OF_FILE) {
+        p->line = start_line;
+        ParseError(p, "Missing endfor for for loop", NULL);
+        p->line = p->line_count;
+        return stmt;
+    }
+    p->line++;
+    return stmt;
+}
+
+Stmt* ParseFunction(Parser* p) {
+    Stmt* stmt = NewStmt(p->arena, STMT_FUNCTION, p->line + 1);
+    int start_line = p->line;
+    int pos = p->pos + 1;
+
+    if (Tok(p, pos)->kind != TOK_IDENT) {
+        ParseError(p, "Syntax error: function requires a name", NULL);
+        return NULL;
+    }
+    TokenName(Tok(p, pos++), stmt->name, sizeof(stmt->name));
+
+    // Optional parameter list
+    if (Tok(p, pos)->kind == TOK_LPAREN) {
+        pos++;
+        while (Tok(p, pos)->kind == TOK_IDENT) {
+            if (stmt->param_count < MAX_PARAMS) {
+                TokenName(Tok(p, pos), stmt->params[stmt->param_count++], 32);
+            } else {
+                ParseError(p, "Too many parameters for", stmt->name);
+            }
+            pos++;
+            if (Tok(p, pos)->kind == TOK_COMMA) pos++;
+        }
+        if (Tok(p, pos)->kind != TOK_RPAREN) {
+            ParseError(p, "Syntax error: bad parameter list for", stmt->name);
+        }
+        pos++;
+    }
+    if (Tok(p, pos)->kind == TOK_LBRACE) pos++;
+    if (pos < p->toks.count) {
+        ParseError(p, "Unexpected tokens after function header", NULL);
+    }
+    if (p->in_function) {
+        ParseError(p, "Nested function definition", stmt->name);
+    }
+    p->line++;
+
+    p->in_function++;
+    BlockEnd end = ParseBlock(p, &stmt->body, NULL, 1);
+    p->in_function--;
+    if (end != BLOCK_CLOSED) {
+        p->line = start_line;
+        ParseError(p, "Missing '}' for function", stmt->name);
+        p->line = p->line_count;
+    }
+
+    Function* func = AddFunction(&p->program->symbols, stmt->name, start_line, p->line - 1, &stmt->body);
+    if (func == NULL) {
+        OutputFormat("Error: Duplicate function '%s'\n", stmt->name);
+        p->program->errors++;
+    } else {
+        func->param_count = stmt->param_count;
+    }
+    return stmt;
+}
+
+// Parses the statement on the current line, consuming every line it spans
+Stmt* ParseStatement(Parser* p) {
+    const Token* first = Tok(p, p->pos);
+    const Token* second = Tok(p, p->pos + 1);
+    int line = p->line + 1;
+    Stmt* stmt = NULL;
+
+    if (first->kind != TOK_IDENT) {
+        ParseError(p, "Unexpected token at start of statement", NULL);
+        p->line++;
+        return NULL;
+    }
+
+    if (TokenIs(first, "if")) return ParseIf(p);
+    if (TokenIs(first, "while")) return ParseWhile(p);
+    if (TokenIs(first, "for")) return ParseFor(p);
+    if (TokenIs(first, "function")) return ParseFunction(p);
+
+    if (TokenIs(first, "print")) {
+        if (AtLineEnd(p) || p->pos + 1 >= p->toks.count) {
+            ParseError(p, "print requires an argument", NULL);
+        } else {
+            stmt = NewStmt(p->arena, STMT_PRINT, line);
+            // Anything that is not an expression prints as literal text
+            ArenaMark mark = ArenaSave(p->arena);
+            p->quiet++;
+            int errors = p->program->errors;
+            stmt->expr = ParseExpressionRange(p, p->pos + 1, p->toks.count);
+            p->program->errors = errors;
+            p->quiet--;
+            if (stmt->expr == NULL) {
+                // Drop whatever the failed attempt allocated
+                ArenaRelease(p->arena, mark);
+                const LineView* view = &p->lines[p->line];
+                const char* text = second->start;
+                int len = (int)(view->start + view->length - text);
+                while (len > 0 && (text[len-1] == ' ' || text[len-1] == '\t' || text[len-1] == '\r')) len--;
+                String* literal = ArenaAlloc(p->arena, sizeof(String) + len + 1);
+                literal->refcount = 1;
+                memcpy(literal->chars, text, len);
+                SealString(literal, len);
+                stmt->expr = NewExpr(p->arena, EXPR_LITERAL);
+                stmt->expr->type = TYPE_STRING;
+                stmt->expr->value.stringValue = literal;
+            }
+        }
+    }
+    else if (TokenIs(first, "input") || TokenIs(first, "goto")) {
+        int is_input = TokenIs(first, "input");
+        if (second->kind != TOK_IDENT || p->pos + 2 != p->toks.count) {
+            ParseError(p, is_input ? "input requires a variable name" : "goto requires a label name", NULL);
+        } else {
+            stmt = NewStmt(p->arena, is_input ? STMT_INPUT : STMT_GOTO, line);
+            TokenName(second, stmt->name, sizeof(stmt->name));
+        }
+    }
+    else if (TokenIs(first, "return")) {
+        if (!p->in_function) {
+            ParseError(p, "return outside function", NULL);
+        } else {
+            stmt = NewStmt(p->arena, STMT_RETURN, line);
+            if (p->pos + 1 < p->toks.count) {
+                stmt->expr = ParseExpressionRange(p, p->pos + 1, p->toks.count);
+            }
+        }
+    }
+    else if (TokenIs(first, "exit")) {
+        stmt = NewStmt(p->arena, STMT_EXIT, line);
+        if (p->pos + 1 < p->toks.count) {
+            stmt->text = ArenaStrndup(p->arena, second->start, second->length);
+        } else {
+            stmt->text = ArenaStrndup(p->arena, "0", 1);
+        }
+    }
+    else if (TokenIs(first, "elseif") || TokenIs(first, "else") || TokenIs(first, "endif")) {
+        char message[64];
+        snprintf(message, sizeof(message), "%.*s without matching if", first->length, first->start);
+        ParseError(p, message, NULL);
+    }
+    else if (TokenIs(first, "endwhile")) {
+        ParseError(p, "endwhile without matching while", NULL);
+    }
+    else if (TokenIs(first, "endfor")) {
+        ParseError(p, "endfor without matching for", NULL);
+    }
+    else if (TypeFromKeyword(first) != TYPE_UNKNOWN || second->kind == TOK_ASSIGN) {
+        stmt = ParseStore(p, p->pos, p->toks.count);
+    }
+    else if (second->kind == TOK_COLON && p->pos + 2 == p->toks.count) {
+        stmt = NewStmt(p->arena, STMT_LABEL, line);
+        TokenName(first, stmt->name, sizeof(stmt->name));
+        if (!AddLabel(&p->program->symbols, stmt->name, p->line)) {
+            ParseError(p, "Duplicate label", stmt->name);
+        }
+    }
+    else if (second->kind == TOK_LPAREN) {
+        int close = MatchingParen(p, p->pos + 1, p->toks.count);
+        if (close != p->toks.count - 1) {
+            char name[32];
+            TokenName(first, name, sizeof(name));
+            ParseError(p, "Syntax error in call to", name);
+        } else {
+            stmt = NewStmt(p->arena, STMT_CALL, line);
+            TokenName(first, stmt->name, sizeof(stmt->name));
+            stmt->args = ParseArguments(p, p->pos + 1, close, &stmt->arg_count);
+        }
+    }
+    else {
+        char name[32];
+        TokenName(first, name, sizeof(name));
+        ParseError(p, "Unknown statement", name);
+    }
+
+    p->line++;
+    return stmt;
+}
+
+// Parses the whole script into an AST. Errors are reported with line numbers
+// and counted in program->errors.
+Program* ParseProgram(const LineView* lines, int line_count) {
+    Parser parser = {0};
+    parser.lines = lines;
+    parser.line_count = line_count;
+    parser.lexed_line = -1;
+    parser.program = calloc(1, sizeof(Program));
+    parser.arena = &parser.program->arena;
+
+    ParseBlock(&parser, &parser.program->main, NULL, 0);
+    free(parser.toks.tokens);
+    return parser.program;
+}
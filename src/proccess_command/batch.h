@@ -0,0 +1,178 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "../commands/output.h"
+#include "../vm/bytecode.h"
+#include "../vm/vm.h"
+
+// Batch mode runs one compiled chunk once per input file on a pool of
+// threads. The chunk is shared read-only; every worker has its own VM,
+// output buffer and input file. Outputs are written in input order as soon
+// as every earlier one is done.
+
+// Inputs still to run on one worker: the owner takes from head, other
+// workers steal from the tail
+typedef struct {
+    pthread_mutex_t lock;
+    int head;
+    int tail;
+} WorkDeque;
+
+typedef struct {
+    char* data;             // Captured output, owned until written
+    size_t length;
+    int done;
+} BatchResult;
+
+typedef struct {
+    const Chunk* chunk;
+    ExecutionLimits limits;
+    int no_jit;
+    const char* const* inputs;
+    int input_count;
+    WorkDeque* deques;
+    int worker_count;
+    BatchResult* results;
+    int next_result;        // First result not written yet
+    pthread_mutex_t results_lock;
+    int fd;
+} Batch;
+
+typedef struct {
+    Batch* batch;
+    int id;
+    int failures;
+    pthread_t thread;
+} BatchWorker;
+
+// Takes the next input of the worker's own deque, or when it is empty
+// steals the back half of another's. Returns -1 when no work is left.
+int TakeWork(Batch* batch, int id) {
+    WorkDeque* own = &batch->deques[id];
+    pthread_mutex_lock(&own->lock);
+    int item = own->head < own->tail ? own->head++ : -1;
+    pthread_mutex_unlock(&own->lock);
+    if (item >= 0) return item;
+
+    for (int i = 1; i < batch->worker_count; i++) {
+        WorkDeque* victim = &batch->deques[(id + i) % batch->worker_count];
+        pthread_mutex_lock(&victim->lock);
+        int available = victim->tail - victim->head;
+        int start = victim->tail - (available + 1) / 2;
+        int end = victim->tail;
+        if (available > 0) victim->tail = start;
+        pthread_mutex_unlock(&victim->lock);
+        if (available <= 0) continue;
+
+        pthread_mutex_lock(&own->lock);
+        own->head = start + 1;
+        own->tail = end;
+        pthread_mutex_unlock(&own->lock);
+        return start;
+    }
+    return -1;
+}
+
+// Hands over the output of one input and writes out every result that is
+// now next in order
+void FinishWork(Batch* batch, int item, char* data, size_t length) {
+    pthread_mutex_lock(&batch->results_lock);
+    batch->results[item].data = data;
+    batch->results[item].length = length;
+    batch->results[item].done = 1;
+    while (batch->next_result < batch->input_count && batch->results[batch->next_result].done) {
+        BatchResult* result = &batch->results[batch->next_result++];
+        WriteAll(batch->fd, result->data, (int)result->length);
+        free(result->data);
+        result->data = NULL;
+    }
+    pthread_mutex_unlock(&batch->results_lock);
+}
+
+void* RunBatchWorker(void* arg) {
+    BatchWorker* worker = arg;
+    Batch* batch = worker->batch;
+    OutputBuffer* buffer = malloc(sizeof(OutputBuffer));
+    InitOutput(buffer, -1);
+    BindOutput(buffer);
+    VM vm;
+    InitVM(&vm, &batch->limits);
+    vm.no_jit = batch->no_jit;
+
+    int item;
+    while ((item = TakeWork(batch, worker->id)) >= 0) {
+        FILE* input = fopen(batch->inputs[item], "r");
+        if (input == NULL) {
+            OutputFormat("Error opening input '%s'\n", batch->inputs[item]);
+            worker->failures++;
+        } else {
+            vm.input = input;
+            if (!RunChunk(&vm, batch->chunk)) worker->failures++;
+            fclose(input);
+        }
+        FlushOutput();
+        FinishWork(batch, item, buffer->capture, buffer->capture_length);
+        InitOutput(buffer, -1);
+    }
+
+    FreeVM(&vm);
+    BindOutput(NULL);
+    free(buffer);
+    return NULL;
+}
+
+// Runs chunk once per input on jobs threads (0 for one per core) and
+// writes the outputs to fd in input order; no_jit keeps every run in the
+// interpreter. Returns the number of runs that failed to open their input
+// or were stopped by a limit.
+int RunBatchChunk(const Chunk* chunk, const ExecutionLimits* limits, int no_jit, const char* const* inputs,
+                  int input_count, int jobs, int fd) {
+    if (jobs <= 0) jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (jobs > input_count) jobs = input_count;
+    if (jobs < 1) jobs = 1;
+
+    Batch batch = {0};
+    batch.chunk = chunk;
+    batch.limits = *limits;
+    batch.no_jit = no_jit;
+    batch.inputs = inputs;
+    batch.input_count = input_count;
+    batch.worker_count = jobs;
+    batch.fd = fd;
+    batch.deques = calloc(jobs, sizeof(WorkDeque));
+    batch.results = calloc(input_count + 1, sizeof(BatchResult));
+    pthread_mutex_init(&batch.results_lock, NULL);
+
+    // Each worker starts with a contiguous share of the inputs
+    BatchWorker* workers = calloc(jobs, sizeof(BatchWorker));
+    for (int i = 0; i < jobs; i++) {
+        pthread_mutex_init(&batch.deques[i].lock, NULL);
+        batch.deques[i].head = (int)((long long)input_count * i / jobs);
+        batch.deques[i].tail = (int)((long long)input_count * (i + 1) / jobs);
+        workers[i].batch = &batch;
+        workers[i].id = i;
+    }
+    for (int i = 0; i < jobs; i++) {
+        pthread_create(&workers[i].thread, NULL, RunBatchWorker, &workers[i]);
+    }
+
+    int failures = 0;
+    for (int i = 0; i < jobs; i++) {
+        pthread_join(workers[i].thread, NULL);
+        failures += workers[i].failures;
+    }
+    // Workers steal from every deque, so none goes before all have stopped
+    for (int i = 0; i < jobs; i++) {
+        pthread_mutex_destroy(&batch.deques[i].lock);
+    }
+
+    pthread_mutex_destroy(&batch.results_lock);
+    free(workers);
+    free(batch.results);
+    free(batch.deques);
+    return failures;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SOURCE_CHUNK_SIZE (64 * 1024)
+
+// One line of the script, pointing into the loaded buffer. The newline is
+// not part of the view and the text is not NUL-terminated.
+typedef struct {
+    const char* start;
+    int length;
+} LineView;
+
+// A whole script held in memory. Regular files are mapped, pipes and stdin
+// are read in chunks into one growing buffer.
+typedef struct {
+    char* data;
+    size_t size;
+    int mapped;
+    LineView* lines;
+    int line_count;
+    int line_capacity;
+} Source;
+
+int ReadStream(Source* source, FILE* file) {
+    size_t capacity = 0;
+    for (;;) {
+        if (source->size + SOURCE_CHUNK_SIZE > capacity) {
+            capacity = capacity ? capacity * 2 : SOURCE_CHUNK_SIZE;
+            source->data = realloc(source->data, capacity);
+        }
+        size_t got = fread(source->data + source->size, 1, capacity - source->size, file);
+        source->size += got;
+        if (got == 0) break;
+    }
+    return !ferror(file);
+}
+
+int MapFile(Source* source, const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return 0;
+
+    struct stat info;
+    int ok = fstat(fd, &info) == 0;
+    if (ok && S_ISREG(info.st_mode) && info.st_size > 0) {
+        void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            source->data = data;
+            source->size = info.st_size;
+            source->mapped = 1;
+            close(fd);
+            return 1;
+        }
+    }
+
+    // Not mappable (a pipe, an empty file): fall back to reading it
+    FILE* file = ok ? fdopen(fd, "r") : NULL;
+    if (file == NULL) {
+        close(fd);
+        return 0;
+    }
+    ok = ReadStream(source, file);
+    fclose(file);
+    return ok;
+}
+
+// Splits the buffer into line views in one pass
+void IndexLines(Source* source) {
+    const char* text = source->data;
+    const char* end = text + source->size;
+    while (text < end) {
+        const char* newline = memchr(text, '\n', end - text);
+        const char* line_end = newline ? newline : end;
+        if (source->line_count >= source->line_capacity) {
+            source->line_capacity = source->line_capacity ? source->line_capacity * 2 : 256;
+            source->lines = realloc(source->lines, source->line_capacity * sizeof(LineView));
+        }
+        source->lines[source->line_count].start = text;
+        source->lines[source->line_count].length = (int)(line_end - text);
+        source->line_count++;
+        text = newline ? newline + 1 : end;
+    }
+}
+
+// Loads a script. A NULL or "-" filename reads standard input.
+int LoadSource(Source* source, const char* filename) {
+    memset(source, 0, sizeof(*source));
+    int ok;
+    if (filename == NULL || strcmp(filename, "-") == 0) {
+        ok = ReadStream(source, stdin);
+    } else {
+        ok = MapFile(source, filename);
+    }
+    if (ok) IndexLines(source);
+    return ok;
+}
+
+// Loads a script held in memory; the text is copied
+void LoadSourceText(Source* source, const char* text, size_t length) {
+    memset(source, 0, sizeof(*source));
+    source->data = malloc(length + 1);
+    memcpy(source->data, text, length);
+    source->size = length;
+    IndexLines(source);
+}
+
+void FreeSource(Source* source) {
+    if (source->mapped) munmap(source->data, source->size);
+    else free(source->data);
+    free(source->lines);
+    memset(source, 0, sizeof(*source));
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+// Immutable reference-counted string. Variable slots and constants each
+// hold a reference; registers borrow the reference of whatever they were
+// loaded from, so copying a string between slots never copies characters.
+// A frozen string (refcount STRING_FROZEN) ignores references and lives as
+// long as the table that owns it, so threads can share it without locking.
+#define STRING_FROZEN -1
+
+typedef struct String {
+    int refcount;
+    int length;
+    unsigned int hash;
+    char chars[];
+} String;
+
+unsigned int HashChars(const char* chars, int length) {
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)chars[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Allocates room for length characters; the caller fills them in and
+// calls SealString
+String* AllocString(int length) {
+    String* string = malloc(sizeof(String) + length + 1);
+    string->refcount = 1;
+    string->length = length;
+    string->hash = 0;
+    string->chars[length] = '\0';
+    return string;
+}
+
+void SealString(String* string, int length) {
+    string->length = length;
+    string->chars[length] = '\0';
+    string->hash = HashChars(string->chars, length);
+}
+
+String* NewString(const char* chars, int length) {
+    String* string = AllocString(length);
+    memcpy(string->chars, chars, length);
+    SealString(string, length);
+    return string;
+}
+
+String* RetainString(String* string) {
+    if (string->refcount != STRING_FROZEN) string->refcount++;
+    return string;
+}
+
+void ReleaseString(String* string) {
+    if (string != NULL && string->refcount != STRING_FROZEN && --string->refcount == 0) free(string);
+}
+
+// Open-addressing set of strings keyed by content, used to share one
+// buffer between identical literals. The table holds a reference to each
+// entry.
+typedef struct {
+    String** buckets;
+    int count;
+    int bucket_count;       // Always a power of two
+} StringTable;
+
+void InsertString(StringTable* table, String* string) {
+    unsigned int mask = table->bucket_count - 1;
+    unsigned int i = string->hash & mask;
+    while (table->buckets[i]) i = (i + 1) & mask;
+    table->buckets[i] = string;
+}
+
+// Returns the shared copy of chars, creating it if needed. The result is
+// borrowed from the table.
+String* InternString(StringTable* table, const char* chars, int length) {
+    unsigned int hash = HashChars(chars, length);
+    if (table->bucket_count > 0) {
+        unsigned int mask = table->bucket_count - 1;
+        for (unsigned int i = hash & mask; table->buckets[i]; i = (i + 1) & mask) {
+            String* entry = table->buckets[i];
+            if (entry->hash == hash && entry->length == length &&
+                memcmp(entry->chars, chars, length) == 0) {
+                return entry;
+            }
+        }
+    }
+
+    // Keep the load factor at or below one half
+    if ((table->count + 1) * 2 > table->bucket_count) {
+        String** old = table->buckets;
+        int old_count = table->bucket_count;
+        table->bucket_count = old_count ? old_count * 2 : 32;
+        table->buckets = calloc(table->bucket_count, sizeof(String*));
+        for (int i = 0; i < old_count; i++) {
+            if (old[i]) InsertString(table, old[i]);
+        }
+        free(old);
+    }
+
+    String* string = NewString(chars, length);
+    InsertString(table, string);
+    table->count++;
+    return string;
+}
+
+// Freezes every entry; nothing may intern into the table afterwards
+void FreezeStringTable(StringTable* table) {
+    for (int i = 0; i < table->bucket_count; i++) {
+        if (table->buckets[i]) table->buckets[i]->refcount = STRING_FROZEN;
+    }
+}
+
+void FreeStringTable(StringTable* table) {
+    for (int i = 0; i < table->bucket_count; i++) {
+        String* string = table->buckets[i];
+        if (string && string->refcount == STRING_FROZEN) free(string);
+        else ReleaseString(string);
+    }
+    free(table->buckets);
+    memset(table, 0, sizeof(*table));
+}
@@ -3,11 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
-
-#define MAX_VARIABLES 100
-#define MAX_LABELS 50
-#define MAX_FUNCTIONS 20
-#define MAX_SCOPES 10
+#include "string_pool.h"
 
 typedef enum {
     TYPE_INT,
@@ -20,149 +16,153 @@ typedef enum {
 typedef union {
     int intValue;
     float floatValue;
-    char* stringValue;
+    String* stringValue;
     int boolValue;
 } Value;
 
-typedef struct Variable {
-    char name[32];
-    VarType type;
-    Value value;
-    int scope;
-} Variable;
+// Interned names with an open-addressing hash index. Ids are dense and
+// never change, so they double as slot numbers.
+typedef struct {
+    char (*names)[32];
+    int count;
+    int capacity;
+    int* buckets;           // Name id + 1, 0 marks an empty bucket
+    int bucket_count;       // Always a power of two
+} NameTable;
 
-typedef struct Label {
-    char name[32];
-    int line_number;
-} Label;
+struct Block;
 
 typedef struct Function {
     char name[32];
     int start_line;
     int end_line;
+    struct Block* body;     // Parsed body, until it is compiled
+    int param_count;        // Parameters are locals 0..param_count-1
+    int entry;              // First instruction of the compiled body
+    int local_count;        // Registers 0..local_count-1 hold locals
+    int register_count;     // Locals plus temporaries
 } Function;
 
-Variable symbol_table[MAX_VARIABLES];
-Label labels[MAX_LABELS];
-Function functions[MAX_FUNCTIONS];
-int var_count = 0;
-int label_count = 0;
-int function_count = 0;
-int current_scope = 0;
-
-Variable* FindVariable(const char* name) 
-{
-    for (int i = var_count - 1; i >= 0; i--) {
-        if (strcmp(symbol_table[i].name, name) == 0 && 
-            symbol_table[i].scope <= current_scope) {
-            return &symbol_table[i];
-        }
+
+unsigned int HashName(const char* name) {
+    unsigned int hash = 2166136261u;
+    for (; *name; name++) {
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
     }
-    return NULL;
+    return hash;
 }
 
-Variable* AddVariable(const char* name, VarType type) 
-{
-    // Check if variable already exists in current scope
-    for (int i = 0; i < var_count; i++) {
-        if (strcmp(symbol_table[i].name, name) == 0 && 
-            symbol_table[i].scope == current_scope) {
-            return NULL;
-        }
-    }
-    
-    if (var_count >= MAX_VARIABLES) {
-        printf("Error: Too many variables\n");
-        return NULL;
+// Returns the id of name, or -1 if it was never interned
+int LookupName(const NameTable* table, const char* name) {
+    if (table->bucket_count == 0) return -1;
+    unsigned int mask = table->bucket_count - 1;
+    for (unsigned int i = HashName(name) & mask; ; i = (i + 1) & mask) {
+        int id = table->buckets[i] - 1;
+        if (id < 0) return -1;
+        if (strcmp(table->names[id], name) == 0) return id;
     }
-    
-    Variable* var = &symbol_table[var_count++];
-    strncpy(var->name, name, sizeof(var->name));
-    var->type = type;
-    var->scope = current_scope;
-    
-    // Initialize with default values
-    switch (type) {
-        case TYPE_INT: var->value.intValue = 0; break;
-        case TYPE_FLOAT: var->value.floatValue = 0.0f; break;
-        case TYPE_STRING: var->value.stringValue = strdup(""); break;
-        case TYPE_BOOL: var->value.boolValue = 0; break;
-        default: break;
-    }
-    return var;
 }
 
-void RemoveVariablesInScope() {
-    int new_count = 0;
-    for (int i = 0; i < var_count; i++) {
-        if (symbol_table[i].scope < current_scope) {
-            if (new_count != i) {
-                symbol_table[new_count] = symbol_table[i];
-            }
-            new_count++;
-        } else {
-            // Free string memory if needed
-            if (symbol_table[i].type == TYPE_STRING) {
-                free(symbol_table[i].value.stringValue);
-            }
-        }
+void RehashNames(NameTable* table, int bucket_count) {
+    free(table->buckets);
+    table->buckets = calloc(bucket_count, sizeof(int));
+    table->bucket_count = bucket_count;
+    unsigned int mask = bucket_count - 1;
+    for (int id = 0; id < table->count; id++) {
+        unsigned int i = HashName(table->names[id]) & mask;
+        while (table->buckets[i]) i = (i + 1) & mask;
+        table->buckets[i] = id + 1;
     }
-    var_count = new_count;
 }
 
-void AddLabel(const char* name, int line_number) {
-    if (label_count >= MAX_LABELS) {
-        printf("Error: Too many labels\n");
-        return;
+// Returns the id of name, adding it if needed
+int InternName(NameTable* table, const char* name) {
+    int id = LookupName(table, name);
+    if (id >= 0) return id;
+
+    if (table->count >= table->capacity) {
+        table->capacity = table->capacity ? table->capacity * 2 : 16;
+        table->names = realloc(table->names, table->capacity * sizeof(*table->names));
     }
-    
-    // Check for duplicate
-    for (int i = 0; i < label_count; i++) {
-        if (strcmp(labels[i].name, name) == 0) {
-            printf("Error: Duplicate label '%s'\n", name);
-            return;
-        }
+    id = table->count++;
+    strncpy(table->names[id], name, sizeof(table->names[id]));
+    table->names[id][31] = '\0';
+
+    // Keep the load factor at or below one half
+    if (table->count * 2 > table->bucket_count) {
+        RehashNames(table, table->bucket_count ? table->bucket_count * 2 : 32);
+    } else {
+        unsigned int mask = table->bucket_count - 1;
+        unsigned int i = HashName(table->names[id]) & mask;
+        while (table->buckets[i]) i = (i + 1) & mask;
+        table->buckets[i] = id + 1;
     }
-    
-    strncpy(labels[label_count].name, name, sizeof(labels[label_count].name));
-    labels[label_count].line_number = line_number;
-    label_count++;
+    return id;
 }
 
-int FindLabel(const char* name) {
-    for (int i = 0; i < label_count; i++) {
-        if (strcmp(labels[i].name, name) == 0) {
-            return labels[i].line_number;
-        }
-    }
-    return -1; // Not found
+void ClearNameTable(NameTable* table) {
+    table->count = 0;
+    if (table->buckets) memset(table->buckets, 0, table->bucket_count * sizeof(int));
 }
 
-void AddFunction(const char* name, int start_line, int end_line) {
-    if (function_count >= MAX_FUNCTIONS) {
-        printf("Error: Too many functions\n");
-        return;
-    }
-    
-    // Check for duplicate
-    for (int i = 0; i < function_count; i++) {
-        if (strcmp(functions[i].name, name) == 0) {
-            printf("Error: Duplicate function '%s'\n", name);
-            return;
-        }
-    }
-    
-    strncpy(functions[function_count].name, name, sizeof(functions[function_count].name));
-    functions[function_count].start_line = start_line;
-    functions[function_count].end_line = end_line;
-    function_count++;
+void FreeNameTable(NameTable* table) {
+    free(table->names);
+    free(table->buckets);
+    memset(table, 0, sizeof(*table));
+}
+
+// Labels and functions of one script, indexed by name once at load so
+// every lookup is a single hash probe. A function's id is its index in
+// functions[].
+typedef struct {
+    NameTable label_names;
+    int* label_lines;
+    NameTable function_names;
+    Function* functions;
+    int function_capacity;
+} SymbolTable;
+
+// Records a label, returns 0 if the name is already taken
+int AddLabel(SymbolTable* symbols, const char* name, int line_number) {
+    if (LookupName(&symbols->label_names, name) >= 0) return 0;
+    int id = InternName(&symbols->label_names, name);
+    symbols->label_lines = realloc(symbols->label_lines, symbols->label_names.capacity * sizeof(int));
+    symbols->label_lines[id] = line_number;
+    return 1;
+}
+
+int FindLabel(const SymbolTable* symbols, const char* name) {
+    int id = LookupName(&symbols->label_names, name);
+    return id < 0 ? -1 : symbols->label_lines[id];
 }
 
-Function* FindFunction(const char* name) {
-    for (int i = 0; i < function_count; i++) {
-        if (strcmp(functions[i].name, name) == 0) {
-            return &functions[i];
-        }
+// Records a function, returns NULL if the name is already taken
+Function* AddFunction(SymbolTable* symbols, const char* name, int start_line, int end_line,
+                      struct Block* body) {
+    if (LookupName(&symbols->function_names, name) >= 0) return NULL;
+    int id = InternName(&symbols->function_names, name);
+    if (id >= symbols->function_capacity) {
+        symbols->function_capacity = symbols->function_names.capacity;
+        symbols->functions = realloc(symbols->functions, symbols->function_capacity * sizeof(Function));
     }
-    return NULL;
+    Function* func = &symbols->functions[id];
+    memset(func, 0, sizeof(*func));
+    strcpy(func->name, symbols->function_names.names[id]);
+    func->start_line = start_line;
+    func->end_line = end_line;
+    func->body = body;
+    return func;
+}
+
+Function* FindFunction(const SymbolTable* symbols, const char* name) {
+    int id = LookupName(&symbols->function_names, name);
+    return id < 0 ? NULL : &symbols->functions[id];
+}
+
+void FreeSymbolTable(SymbolTable* symbols) {
+    FreeNameTable(&symbols->label_names);
+    FreeNameTable(&symbols->function_names);
+    free(symbols->label_lines);
+    free(symbols->functions);
+    memset(symbols, 0, sizeof(*symbols));
 }
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include "../variable/symbol_table.h"
+#include "../commands/output.h"
+
+// Every opcode, in dispatch table order, with the kinds of its a, b and c
+// operands: R a register of the current frame (locals first, then
+// temporaries), W a register or -1, A the first register of the called
+// function's arguments, G a global slot, K a constant, N a name, J an
+// absolute jump target in the same function, F a function id, T a declared
+// type, and _ an immediate or an unused operand.
+#define OPCODE_LIST(X)                                                      \
+    X(OP_LOADK, R, K, _)           /* R[a] = K[b]                        */ \
+    X(OP_MOVE, R, R, _)            /* R[a] = R[b]                        */ \
+    X(OP_GETGLOBAL, R, G, _)       /* R[a] = G[b]                        */ \
+    X(OP_SETGLOBAL, R, G, T)       /* G[b] = R[a], checked against c     */ \
+    X(OP_SETLOCAL, R, R, T)        /* R[a] = R[b], checked against c     */ \
+    X(OP_SETGLOBAL_TYPED, R, G, _) /* G[b] = R[a], proven to fit         */ \
+    X(OP_ADD, R, R, R)             /* R[a] = R[b] + R[c]                 */ \
+    X(OP_SUB, R, R, R)                                                      \
+    X(OP_MUL, R, R, R)                                                      \
+    X(OP_DIV, R, R, R)                                                      \
+    X(OP_EQ, R, R, R)              /* R[a] = R[b] == R[c]                */ \
+    X(OP_NE, R, R, R)                                                       \
+    X(OP_LT, R, R, R)                                                       \
+    X(OP_GT, R, R, R)                                                       \
+    X(OP_LE, R, R, R)                                                       \
+    X(OP_GE, R, R, R)                                                       \
+    X(OP_NOT, R, R, _)             /* R[a] = !R[b]                       */ \
+    X(OP_NEG, R, R, _)             /* R[a] = -R[b]                       */ \
+    X(OP_JUMP, _, J, _)            /* goto b, burning c fuel             */ \
+    X(OP_JUMP_IF_FALSE, R, J, J)   /* if !R[a] goto b, non-boolean       */ \
+                                   /* goto c                             */ \
+    X(OP_JUMP_IF_TRUE, R, J, _)    /* if R[a] goto b burning c fuel,     */ \
+                                   /* else fall through                  */ \
+    X(OP_SKIP_AND, R, J, _)        /* if !R[a] goto b                    */ \
+    X(OP_SKIP_OR, R, J, _)         /* if R[a] goto b                     */ \
+    X(OP_CHECK_BOOL, R, _, _)      /* R[a] must be boolean, c is 0 for   */ \
+                                   /* && and 1 for ||                    */ \
+    X(OP_PRINT, R, _, _)           /* print R[a]                         */ \
+    X(OP_INPUT_LOCAL, R, _, N)     /* read R[a], prompting with N[c]     */ \
+    X(OP_INPUT_GLOBAL, _, G, N)    /* read G[b], prompting with N[c]     */ \
+    X(OP_CALL, F, A, W)            /* call function a with arguments     */ \
+                                   /* from R[b], its result goes to R[c] */ \
+                                   /* unless c is -1                     */ \
+    X(OP_TAILCALL, F, A, _)        /* replace this call by a call to     */ \
+                                   /* function a with arguments from R[b]*/ \
+    X(OP_RETURN, R, _, _)          /* return R[a] if b, else nothing     */ \
+    X(OP_EXIT, _, K, _)            /* stop with exit code K[b]           */ \
+    X(OP_HALT, _, _, _)                                                     \
+    /* Superinstructions, each emitted in front of the generic code it   */ \
+    /* replaces. When the operands are not both ints (or both floats for */ \
+    /* the jumps) they fall through to that code, otherwise they skip it.*/ \
+    X(OP_INCR_LOCAL, R, _, J)      /* R[a] += b, then goto c             */ \
+    X(OP_INCR_GLOBAL, G, _, J)     /* G[a] += b, then goto c             */ \
+    /* if R[a] <cmp> R[b] goto c, else skip the next 2 instructions      */ \
+    X(OP_JUMP_EQ_RR, R, R, J) X(OP_JUMP_NE_RR, R, R, J)                     \
+    X(OP_JUMP_LT_RR, R, R, J) X(OP_JUMP_GT_RR, R, R, J)                     \
+    X(OP_JUMP_LE_RR, R, R, J) X(OP_JUMP_GE_RR, R, R, J)                     \
+    /* if R[a] <cmp> K[b] goto c, else skip the next 3 instructions      */ \
+    X(OP_JUMP_EQ_RK, R, K, J) X(OP_JUMP_NE_RK, R, K, J)                     \
+    X(OP_JUMP_LT_RK, R, K, J) X(OP_JUMP_GT_RK, R, K, J)                     \
+    X(OP_JUMP_LE_RK, R, K, J) X(OP_JUMP_GE_RK, R, K, J)                     \
+    /* if G[a] <cmp> K[b] goto c, else skip the next 4 instructions      */ \
+    X(OP_JUMP_EQ_GK, G, K, J) X(OP_JUMP_NE_GK, G, K, J)                     \
+    X(OP_JUMP_LT_GK, G, K, J) X(OP_JUMP_GT_GK, G, K, J)                     \
+    X(OP_JUMP_LE_GK, G, K, J) X(OP_JUMP_GE_GK, G, K, J)                     \
+    /* Quickened forms of OP_ADD..OP_GE, in the same order, for two int  */ \
+    /* (_II) or two float (_FF) operands. The compiler emits them where  */ \
+    /* the type checker proved the operand types; elsewhere the VM       */ \
+    /* writes them over the generic instruction once it has seen the     */ \
+    /* operand types, and back when the types change.                    */ \
+    X(OP_ADD_II, R, R, R) X(OP_SUB_II, R, R, R) X(OP_MUL_II, R, R, R)       \
+    X(OP_DIV_II, R, R, R) X(OP_EQ_II, R, R, R) X(OP_NE_II, R, R, R)         \
+    X(OP_LT_II, R, R, R) X(OP_GT_II, R, R, R) X(OP_LE_II, R, R, R)          \
+    X(OP_GE_II, R, R, R)                                                    \
+    X(OP_ADD_FF, R, R, R) X(OP_SUB_FF, R, R, R) X(OP_MUL_FF, R, R, R)       \
+    X(OP_DIV_FF, R, R, R) X(OP_EQ_FF, R, R, R) X(OP_NE_FF, R, R, R)         \
+    X(OP_LT_FF, R, R, R) X(OP_GT_FF, R, R, R) X(OP_LE_FF, R, R, R)          \
+    X(OP_GE_FF, R, R, R)
+
+#define OPCODE_ENUM(name, a, b, c) name,
+typedef enum {
+    OPCODE_LIST(OPCODE_ENUM)
+    OP_COUNT
+} OpCode;
+#undef OPCODE_ENUM
+
+#define OPCODE_NAME(name, a, b, c) #name,
+const char* opcode_names[] = {
+    OPCODE_LIST(OPCODE_NAME)
+};
+#undef OPCODE_NAME
+
+// Operand kinds of each opcode, one letter each for a, b and c
+#define OPCODE_OPERANDS(name, a, b, c) #a #b #c,
+const char* opcode_operands[] = {
+    OPCODE_LIST(OPCODE_OPERANDS)
+};
+#undef OPCODE_OPERANDS
+
+typedef struct {
+    unsigned short op;
+    int a;
+    int b;
+    int c;
+} Instruction;
+
+// A register or constant: a value tagged with its type
+typedef struct {
+    VarType type;
+    Value value;
+} Slot;
+
+typedef struct {
+    Instruction* code;
+    int* lines;             // Source line of each instruction
+    unsigned char* starts;  // Whether each instruction starts a run of its
+                            // line, for the profiler's execution counts
+    int count;
+    int capacity;
+    Slot* constants;
+    int constant_count;
+    int constant_capacity;
+    StringTable strings;    // Shared storage of string constants
+    NameTable names;        // Names used in prompts
+    NameTable globals;      // Global slot of each top-level variable
+    VarType* global_types;  // Declared type of each global slot
+    int main_registers;     // Register window of the top-level code
+    int main_locals;        // Registers of it that hold call results
+    Function* functions;    // Compiled functions, indexed by function id
+    int function_count;
+    void* image;            // Mapped cache file the code, lines and string
+    size_t image_size;      // constants point into, if loaded from one
+} Chunk;
+
+int EmitInstruction(Chunk* chunk, OpCode op, int a, int b, int c, int line) {
+    if (chunk->count >= chunk->capacity) {
+        chunk->capacity = chunk->capacity ? chunk->capacity * 2 : 64;
+        chunk->code = realloc(chunk->code, chunk->capacity * sizeof(Instruction));
+        chunk->lines = realloc(chunk->lines, chunk->capacity * sizeof(int));
+        chunk->starts = realloc(chunk->starts, chunk->capacity);
+    }
+    Instruction* ins = &chunk->code[chunk->count];
+    ins->op = (unsigned short)op;
+    ins->a = a;
+    ins->b = b;
+    ins->c = c;
+    chunk->lines[chunk->count] = line;
+    chunk->starts[chunk->count] = 0;
+    return chunk->count++;
+}
+
+// Adds a constant; a string value passes its reference to the chunk
+int AddConstant(Chunk* chunk, VarType type, Value value) {
+    if (chunk->constant_count >= chunk->constant_capacity) {
+        chunk->constant_capacity = chunk->constant_capacity ? chunk->constant_capacity * 2 : 16;
+        chunk->constants = realloc(chunk->constants, chunk->constant_capacity * sizeof(Slot));
+    }
+    chunk->constants[chunk->constant_count].type = type;
+    chunk->constants[chunk->constant_count].value = value;
+    return chunk->constant_count++;
+}
+
+int AddStringConstant(Chunk* chunk, const char* chars, int length) {
+    Value value;
+    value.stringValue = RetainString(InternString(&chunk->strings, chars, length));
+    return AddConstant(chunk, TYPE_STRING, value);
+}
+
+// Adds a global slot, or returns the existing one for name
+int AddGlobal(Chunk* chunk, const char* name, VarType type) {
+    int slot = LookupName(&chunk->globals, name);
+    if (slot >= 0) return slot;
+    slot = InternName(&chunk->globals, name);
+    chunk->global_types = realloc(chunk->global_types, chunk->globals.capacity * sizeof(VarType));
+    chunk->global_types[slot] = type;
+    return slot;
+}
+
+void FreeChunk(Chunk* chunk) {
+    for (int i = 0; i < chunk->constant_count; i++) {
+        if (chunk->constants[i].type == TYPE_STRING) {
+            ReleaseString(chunk->constants[i].value.stringValue);
+        }
+    }
+    if (chunk->image) {
+        munmap(chunk->image, chunk->image_size);
+    } else {
+        free(chunk->code);
+        free(chunk->lines);
+        free(chunk->starts);
+    }
+    free(chunk->functions);
+    free(chunk->constants);
+    FreeStringTable(&chunk->strings);
+    FreeNameTable(&chunk->names);
+    FreeNameTable(&chunk->globals);
+    free(chunk->global_types);
+    free(chunk);
+}
+
+void DisassembleChunk(const Chunk* chunk) {
+    for (int i = 0; i < chunk->count; i++) {
+        const Instruction* ins = &chunk->code[i];
+        OutputFormat("%04d %4d  %-18s %d %d %d\n", i, chunk->lines[i],
+               opcode_names[ins->op], ins->a, ins->b, ins->c);
+    }
+}
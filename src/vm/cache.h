@@ -0,0 +1,393 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bytecode.h"
+
+// Compiled chunks cached on disk. A cache file is named after a hash of
+// the script text and of everything in the interpreter that shapes the
+// bytecode, so an edited script or a rebuilt interpreter never picks up a
+// stale file. The file also holds the script text itself, and a file is
+// only used when that text matches, so two scripts whose hashes collide
+// never run each other's bytecode. Loading one maps it and points the
+// chunk's code, lines and string constants straight into the mapping, so
+// a cached script starts without lexing, parsing or compiling.
+
+#define CACHE_MAGIC "MINIBC\0\0"
+#define CACHE_FORMAT_VERSION 4
+
+typedef struct {
+    char magic[8];
+    unsigned long long key;
+    unsigned long long source_size;
+    int code_count;
+    int constant_count;
+    int name_count;
+    int global_count;
+    int function_count;
+    int main_registers;
+    int main_locals;
+    int padding;
+    // Byte offsets of each section from the start of the file
+    unsigned long long code;
+    unsigned long long lines;
+    unsigned long long starts;
+    unsigned long long constants;
+    unsigned long long strings;
+    unsigned long long strings_end;
+    unsigned long long names;
+    unsigned long long globals;
+    unsigned long long global_types;
+    unsigned long long functions;
+    unsigned long long source;
+    unsigned long long end;
+} CacheHeader;
+
+// A constant as stored: numbers and booleans by their bits, strings by the
+// offset of their String record in the strings section
+typedef struct {
+    int type;
+    int bits;
+    unsigned long long string;
+} CachedConstant;
+
+unsigned long long HashBytes64(unsigned long long hash, const void* data, size_t size) {
+    const unsigned char* bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// Cache key of a script: its text, the instruction set and the layout of
+// everything stored raw, and compile options. The key only names the file;
+// the loader still compares the stored text.
+unsigned long long CacheKey(const char* text, size_t size, int tail_calls, unsigned int passes) {
+    unsigned long long hash = 14695981039346656037ull;
+    int format[] = { CACHE_FORMAT_VERSION, OP_COUNT, (int)sizeof(Instruction),
+                     (int)sizeof(Function), (int)sizeof(String), tail_calls, (int)passes };
+    hash = HashBytes64(hash, format, sizeof(format));
+    for (int i = 0; i < OP_COUNT; i++) {
+        hash = HashBytes64(hash, opcode_names[i], strlen(opcode_names[i]) + 1);
+    }
+    return HashBytes64(hash, text, size);
+}
+
+void CachePath(char* path, size_t size, const char* dir, unsigned long long key) {
+    snprintf(path, size, "%s/%016llx.mic", dir, key);
+}
+
+// Growing byte buffer the image is assembled in
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+} ImageBuffer;
+
+unsigned long long AppendImage(ImageBuffer* image, const void* data, size_t size) {
+    size_t offset = (image->length + 7) & ~(size_t)7;
+    if (offset + size > image->capacity) {
+        size_t capacity = image->capacity ? image->capacity : 4096;
+        while (capacity < offset + size) capacity *= 2;
+        image->data = realloc(image->data, capacity);
+        image->capacity = capacity;
+    }
+    memset(image->data + image->length, 0, offset - image->length);
+    if (data) memcpy(image->data + offset, data, size);
+    else memset(image->data + offset, 0, size);
+    image->length = offset + size;
+    return offset;
+}
+
+// Appends a frozen copy of string laid out like AllocString's, returns its
+// offset
+unsigned long long AppendFrozenString(ImageBuffer* image, const String* string) {
+    unsigned long long offset = AppendImage(image, NULL, sizeof(String) + string->length + 1);
+    String* record = (String*)(image->data + offset);
+    record->refcount = STRING_FROZEN;
+    record->length = string->length;
+    record->hash = string->hash;
+    memcpy(record->chars, string->chars, string->length + 1);
+    return offset;
+}
+
+// Writes chunk to path through a temporary file, so a reader never sees a
+// partly written cache. Failures only cost the cache.
+void SaveCachedChunk(const Chunk* chunk, const char* path, unsigned long long key, const char* source,
+                     size_t source_size) {
+    ImageBuffer image = {0};
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    AppendImage(&image, &header, sizeof(header));
+
+    memcpy(header.magic, CACHE_MAGIC, 8);
+    header.key = key;
+    header.source_size = source_size;
+    header.code_count = chunk->count;
+    header.constant_count = chunk->constant_count;
+    header.name_count = chunk->names.count;
+    header.global_count = chunk->globals.count;
+    header.function_count = chunk->function_count;
+    header.main_registers = chunk->main_registers;
+    header.main_locals = chunk->main_locals;
+    header.code = AppendImage(&image, chunk->code, chunk->count * sizeof(Instruction));
+    header.lines = AppendImage(&image, chunk->lines, chunk->count * sizeof(int));
+    header.starts = AppendImage(&image, chunk->starts, chunk->count);
+
+    // String constants become frozen String records the loader points at
+    CachedConstant* constants = calloc(chunk->constant_count + 1, sizeof(CachedConstant));
+    header.strings = AppendImage(&image, NULL, 0);
+    for (int i = 0; i < chunk->constant_count; i++) {
+        const Slot* slot = &chunk->constants[i];
+        constants[i].type = slot->type;
+        if (slot->type == TYPE_STRING) {
+            constants[i].string = AppendFrozenString(&image, slot->value.stringValue);
+        } else {
+            memcpy(&constants[i].bits, &slot->value, sizeof(int));
+        }
+    }
+    header.strings_end = image.length;
+    header.constants = AppendImage(&image, constants, chunk->constant_count * sizeof(CachedConstant));
+    free(constants);
+
+    header.names = AppendImage(&image, chunk->names.names, chunk->names.count * sizeof(*chunk->names.names));
+    header.globals = AppendImage(&image, chunk->globals.names, chunk->globals.count * sizeof(*chunk->globals.names));
+    header.global_types = AppendImage(&image, chunk->global_types, chunk->globals.count * sizeof(VarType));
+    header.functions = AppendImage(&image, chunk->functions, chunk->function_count * sizeof(Function));
+    header.source = AppendImage(&image, source, source_size);
+    header.end = image.length;
+    memcpy(image.data, &header, sizeof(header));
+
+    char temp[4096];
+    snprintf(temp, sizeof(temp), "%s.%d.tmp", path, (int)getpid());
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        int ok = 1;
+        size_t written = 0;
+        while (ok && written < image.length) {
+            ssize_t n = write(fd, image.data + written, image.length - written);
+            if (n < 0) ok = 0;
+            else written += n;
+        }
+        close(fd);
+        if (!ok || rename(temp, path) != 0) unlink(temp);
+    }
+    free(image.data);
+}
+
+int CacheSectionFits(const CacheHeader* header, unsigned long long offset, unsigned long long size,
+                     size_t file_size) {
+    return offset <= header->end && size <= header->end - offset && header->end <= file_size;
+}
+
+// Largest register window of a cached frame. The register stack grows by
+// doubling an int capacity, so a frame must stay far below INT_MAX.
+#define CACHE_MAX_REGISTERS (1 << 24)
+
+int CachedFrameFits(int param_count, int local_count, int register_count) {
+    return param_count >= 0 && param_count <= local_count && local_count <= register_count &&
+           register_count <= CACHE_MAX_REGISTERS;
+}
+
+// Names are stored as 32-byte records that InternName reads as C strings
+int CachedNamesFit(const char (*names)[32], int count) {
+    for (int i = 0; i < count; i++) {
+        if (memchr(names[i], '\0', 32) == NULL) return 0;
+    }
+    return 1;
+}
+
+// The top-level code or one function: its instructions and registers
+typedef struct {
+    int start;
+    int end;
+    int register_count;
+} CachedFrame;
+
+// Whether operand x of the given kind (see OPCODE_LIST) is in bounds for
+// an instruction of frame
+int CachedOperandFits(const CacheHeader* header, const Function* functions,
+                      const CachedFrame* frame, const Instruction* ins, char kind, int x) {
+    switch (kind) {
+        case 'R': return x >= 0 && x < frame->register_count;
+        case 'W': return x >= -1 && x < frame->register_count;
+        case 'A': return x >= 0 && x <= frame->register_count &&
+                         functions[ins->a].param_count <= frame->register_count - x;
+        case 'G': return x >= 0 && x < header->global_count;
+        case 'K': return x >= 0 && x < header->constant_count;
+        case 'N': return x >= 0 && x < header->name_count;
+        case 'J': return x >= frame->start && x < frame->end;
+        case 'F': return x >= 0 && x < header->function_count;
+        case 'T': return x >= 0 && x <= TYPE_UNKNOWN;
+        default: return 1;
+    }
+}
+
+// Checks every instruction of frame against the operand kinds of its
+// opcode, so nothing the VM or the JIT indexes with an operand can fall
+// outside the chunk
+int CachedFrameCodeFits(const CacheHeader* header, const Instruction* code,
+                        const CachedConstant* constants, const Function* functions,
+                        const CachedFrame* frame, OpCode terminator) {
+    if (frame->start >= frame->end || code[frame->end - 1].op != terminator) return 0;
+    for (int pc = frame->start; pc < frame->end; pc++) {
+        const Instruction* ins = &code[pc];
+        if (ins->op >= OP_COUNT) return 0;
+        const char* kinds = opcode_operands[ins->op];
+        // A return without a value has no register
+        char a_kind = ins->op == OP_RETURN && !ins->b ? '_' : kinds[0];
+        // a goes first, it is the function every A operand is checked against
+        if (!CachedOperandFits(header, functions, frame, ins, a_kind, ins->a) ||
+            !CachedOperandFits(header, functions, frame, ins, kinds[1], ins->b) ||
+            !CachedOperandFits(header, functions, frame, ins, kinds[2], ins->c)) {
+            return 0;
+        }
+        if (ins->op == OP_EXIT && constants[ins->b].type != TYPE_STRING) return 0;
+        // Compare-and-jumps skip the generic code they were fused with
+        int skip = 0;
+        if (ins->op >= OP_JUMP_EQ_RR && ins->op <= OP_JUMP_GE_RR) skip = 2;
+        if (ins->op >= OP_JUMP_EQ_RK && ins->op <= OP_JUMP_GE_RK) skip = 3;
+        if (ins->op >= OP_JUMP_EQ_GK && ins->op <= OP_JUMP_GE_GK) skip = 4;
+        if (skip && pc + skip + 1 >= frame->end) return 0;
+    }
+    return 1;
+}
+
+// Splits the code into the top-level code, which starts at instruction 0,
+// and the functions that follow it, then checks each
+int CachedCodeFits(const CacheHeader* header, const Instruction* code,
+                   const CachedConstant* constants, const Function* functions) {
+    // The function starting at each instruction, plus one
+    int* entries = calloc(header->code_count + 1, sizeof(int));
+    int ok = 1;
+    for (int i = 0; ok && i < header->function_count; i++) {
+        ok = entries[functions[i].entry] == 0;
+        entries[functions[i].entry] = i + 1;
+    }
+    CachedFrame frame = { 0, 0, header->main_registers };
+    OpCode terminator = OP_HALT;
+    for (int pc = 1; ok && pc <= header->code_count; pc++) {
+        if (pc < header->code_count && entries[pc] == 0) continue;
+        frame.end = pc;
+        ok = CachedFrameCodeFits(header, code, constants, functions, &frame, terminator);
+        if (pc < header->code_count) {
+            frame.start = pc;
+            frame.register_count = functions[entries[pc] - 1].register_count;
+            terminator = OP_RETURN;
+        }
+    }
+    free(entries);
+    return ok;
+}
+
+// Returns the cached chunk for key, or NULL when there is no usable file.
+// Nothing in the file is trusted: every count, offset and operand is
+// checked before the chunk can run, and a file that fails any check is
+// ignored so the script compiles again.
+Chunk* LoadCachedChunk(const char* path, unsigned long long key, const char* source, size_t source_size,
+                       int line_count) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(CacheHeader)) {
+        close(fd);
+        return NULL;
+    }
+    size_t size = info.st_size;
+    char* image = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) return NULL;
+
+    const CacheHeader* header = (const CacheHeader*)image;
+    int ok = memcmp(header->magic, CACHE_MAGIC, 8) == 0 && header->key == key &&
+             header->source_size == source_size &&
+             header->code_count > 0 && header->constant_count >= 0 && header->name_count >= 0 &&
+             header->global_count >= 0 && header->function_count >= 0 &&
+             CacheSectionFits(header, header->code, (unsigned long long)header->code_count * sizeof(Instruction), size) &&
+             CacheSectionFits(header, header->lines, (unsigned long long)header->code_count * sizeof(int), size) &&
+             CacheSectionFits(header, header->starts, (unsigned long long)header->code_count, size) &&
+             CacheSectionFits(header, header->strings, header->strings_end - header->strings, size) &&
+             CacheSectionFits(header, header->constants, (unsigned long long)header->constant_count * sizeof(CachedConstant), size) &&
+             CacheSectionFits(header, header->names, (unsigned long long)header->name_count * 32, size) &&
+             CacheSectionFits(header, header->globals, (unsigned long long)header->global_count * 32, size) &&
+             CacheSectionFits(header, header->global_types, (unsigned long long)header->global_count * sizeof(VarType), size) &&
+             CacheSectionFits(header, header->functions, (unsigned long long)header->function_count * sizeof(Function), size) &&
+             CacheSectionFits(header, header->source, source_size, size) &&
+             memcmp(image + header->source, source, source_size) == 0;
+    ok = ok && CachedFrameFits(0, header->main_locals, header->main_registers);
+    const CachedConstant* constants = (const CachedConstant*)(image + header->constants);
+    for (int i = 0; ok && i < header->constant_count; i++) {
+        ok = constants[i].type >= 0 && constants[i].type <= TYPE_UNKNOWN;
+        if (!ok || constants[i].type != TYPE_STRING) continue;
+        unsigned long long offset = constants[i].string;
+        ok = offset >= header->strings && offset + sizeof(String) <= header->strings_end;
+        if (ok) {
+            const String* string = (const String*)(image + offset);
+            ok = string->refcount == STRING_FROZEN && string->length >= 0 &&
+                 offset + sizeof(String) + string->length + 1 <= header->strings_end &&
+                 string->chars[string->length] == '\0';
+        }
+    }
+    const Function* functions = (const Function*)(image + header->functions);
+    for (int i = 0; ok && i < header->function_count; i++) {
+        const Function* function = &functions[i];
+        ok = function->entry > 0 && function->entry < header->code_count &&
+             CachedFrameFits(function->param_count, function->local_count, function->register_count) &&
+             memchr(function->name, '\0', sizeof(function->name)) != NULL;
+    }
+    const VarType* global_types = (const VarType*)(image + header->global_types);
+    for (int i = 0; ok && i < header->global_count; i++) {
+        ok = global_types[i] >= 0 && global_types[i] <= TYPE_UNKNOWN;
+    }
+    const int* lines = (const int*)(image + header->lines);
+    const unsigned char* starts = (const unsigned char*)(image + header->starts);
+    for (int i = 0; ok && i < header->code_count; i++) {
+        ok = lines[i] >= 0 && lines[i] <= line_count && starts[i] <= 1;
+    }
+    ok = ok && CachedNamesFit((const char (*)[32])(image + header->names), header->name_count) &&
+         CachedNamesFit((const char (*)[32])(image + header->globals), header->global_count) &&
+         CachedCodeFits(header, (const Instruction*)(image + header->code), constants, functions);
+    if (!ok) {
+        munmap(image, size);
+        return NULL;
+    }
+
+    Chunk* chunk = calloc(1, sizeof(Chunk));
+    chunk->image = image;
+    chunk->image_size = size;
+    chunk->code = (Instruction*)(image + header->code);
+    chunk->lines = (int*)(image + header->lines);
+    chunk->starts = (unsigned char*)(image + header->starts);
+    chunk->count = chunk->capacity = header->code_count;
+    chunk->main_registers = header->main_registers;
+    chunk->main_locals = header->main_locals;
+
+    chunk->constant_count = chunk->constant_capacity = header->constant_count;
+    chunk->constants = calloc(header->constant_count + 1, sizeof(Slot));
+    for (int i = 0; i < header->constant_count; i++) {
+        chunk->constants[i].type = (VarType)constants[i].type;
+        if (constants[i].type == TYPE_STRING) {
+            chunk->constants[i].value.stringValue = (String*)(image + constants[i].string);
+        } else {
+            memcpy(&chunk->constants[i].value, &constants[i].bits, sizeof(int));
+        }
+    }
+
+    const char (*names)[32] = (const char (*)[32])(image + header->names);
+    for (int i = 0; i < header->name_count; i++) InternName(&chunk->names, names[i]);
+    const char (*globals)[32] = (const char (*)[32])(image + header->globals);
+    for (int i = 0; i < header->global_count; i++) InternName(&chunk->globals, globals[i]);
+    chunk->global_types = malloc((header->global_count + 1) * sizeof(VarType));
+    memcpy(chunk->global_types, image + header->global_types, header->global_count * sizeof(VarType));
+
+    chunk->function_count = header->function_count;
+    chunk->functions = malloc((header->function_count + 1) * sizeof(Function));
+    memcpy(chunk->functions, image + header->functions, header->function_count * sizeof(Function));
+    for (int i = 0; i < header->function_count; i++) chunk->functions[i].body = NULL;
+    return chunk;
+}
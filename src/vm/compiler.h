@@ -0,0 +1,611 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "../variable/symbol_table.h"
+#include "../parser/ast.h"
+#include "bytecode.h"
+
+typedef struct {
+    char name[32];
+    int pc;
+    int line;
+} LabelRef;
+
+// Where a name lives: depth 0 is a global slot, depth 1 a local register
+// of the enclosing function, -1 an undeclared name
+typedef struct {
+    int depth;
+    int slot;
+    VarType type;
+} VariableRef;
+
+typedef struct {
+    Chunk* chunk;
+    SymbolTable* symbols;   // Functions of the script being compiled
+    int tail_calls;         // Compile `return f(...)` as a tail call
+    int next_register;
+    int max_register;
+    int in_function;
+    NameTable locals;       // Locals of the function being compiled
+    VarType* local_types;
+    int local_type_capacity;
+    int next_call_slot;     // Next register reserved for a call result
+    NameTable labels;       // Labels of the function being compiled
+    int* label_pcs;         // Instruction each label points at
+    int label_pc_capacity;
+    LabelRef* gotos;        // Jumps waiting for their label
+    int goto_count;
+    int goto_capacity;
+    int errors;
+} Compiler;
+
+int AllocRegister(Compiler* c) {
+    int reg = c->next_register++;
+    if (c->next_register > c->max_register) c->max_register = c->next_register;
+    return reg;
+}
+
+void FreeRegister(Compiler* c, int reg) {
+    c->next_register = reg;
+}
+
+void PushGoto(Compiler* c, const char* name, int pc, int line) {
+    if (c->goto_count >= c->goto_capacity) {
+        c->goto_capacity = c->goto_capacity ? c->goto_capacity * 2 : 16;
+        c->gotos = realloc(c->gotos, c->goto_capacity * sizeof(LabelRef));
+    }
+    LabelRef* ref = &c->gotos[c->goto_count++];
+    strcpy(ref->name, name);
+    ref->pc = pc;
+    ref->line = line;
+}
+
+VariableRef ResolveVariable(Compiler* c, const char* name) {
+    VariableRef ref = { -1, -1, TYPE_UNKNOWN };
+    if (c->in_function) {
+        int slot = LookupName(&c->locals, name);
+        if (slot >= 0) {
+            ref.depth = 1;
+            ref.slot = slot;
+            ref.type = c->local_types[slot];
+            return ref;
+        }
+    }
+    int slot = LookupName(&c->chunk->globals, name);
+    if (slot >= 0) {
+        ref.depth = 0;
+        ref.slot = slot;
+        ref.type = c->chunk->global_types[slot];
+    }
+    return ref;
+}
+
+void AddLocal(Compiler* c, const char* name, VarType type) {
+    if (LookupName(&c->locals, name) >= 0) return;
+    int slot = InternName(&c->locals, name);
+    if (slot >= c->local_type_capacity) {
+        c->local_type_capacity = c->locals.capacity;
+        c->local_types = realloc(c->local_types, c->local_type_capacity * sizeof(VarType));
+    }
+    c->local_types[slot] = type;
+}
+
+// Gives every declaration in the block a slot before any code is compiled,
+// so a name means the same variable everywhere in its function. The first
+// declaration of a name fixes its type.
+void CollectDeclarations(Compiler* c, const Block* block) {
+    for (int i = 0; i < block->count; i++) {
+        const Stmt* stmt = block->items[i];
+        const Stmt* store = stmt->kind == STMT_FOR ? stmt->init : stmt;
+        if (store && store->kind == STMT_DECLARE) {
+            if (c->in_function) AddLocal(c, store->name, store->type);
+            else AddGlobal(c->chunk, store->name, store->type);
+        }
+        if (stmt->kind != STMT_FUNCTION) {
+            CollectDeclarations(c, &stmt->body);
+            CollectDeclarations(c, &stmt->else_body);
+        }
+    }
+}
+
+int CountCallsInExpression(const Expr* expr) {
+    if (expr == NULL) return 0;
+    int count = expr->kind == EXPR_CALL;
+    count += CountCallsInExpression(expr->left) + CountCallsInExpression(expr->right);
+    for (int i = 0; i < expr->arg_count; i++) count += CountCallsInExpression(expr->args[i]);
+    return count;
+}
+
+int Max(int a, int b) {
+    return a > b ? a : b;
+}
+
+// Most call expressions one statement of a body evaluates. Each holds its
+// result in a register of its own until the statement ends; the next
+// statement reuses the same registers.
+int CountCalls(const Block* block) {
+    int most = 0;
+    for (int i = 0; i < block->count; i++) {
+        const Stmt* stmt = block->items[i];
+        if (stmt->kind == STMT_FUNCTION) continue;
+        int count = CountCallsInExpression(stmt->expr);
+        for (int j = 0; j < stmt->arg_count; j++) count += CountCallsInExpression(stmt->args[j]);
+        if (stmt->init) count = Max(count, CountCallsInExpression(stmt->init->expr));
+        if (stmt->increment) count = Max(count, CountCallsInExpression(stmt->increment->expr));
+        most = Max(most, count);
+        most = Max(most, Max(CountCalls(&stmt->body), CountCalls(&stmt->else_body)));
+    }
+    return most;
+}
+
+void CompileExpression(Compiler* c, const Expr* expr, int dst, int line);
+
+// Evaluates the arguments into consecutive registers at the top of the
+// frame, where they become the callee's parameters, and calls. result is
+// the register that receives the return value, or -1 to drop it. op is
+// OP_CALL or OP_TAILCALL, which has no result of its own.
+void CompileCall(Compiler* c, OpCode op, const char* name, Expr* const* args, int arg_count,
+                 int result, int line) {
+    Function* func = FindFunction(c->symbols, name);
+    if (func == NULL) {
+        OutputFormat("Error: line %d: function '%s' not defined\n", line, name);
+        c->errors++;
+        return;
+    }
+    if (arg_count != func->param_count) {
+        OutputFormat("Error: line %d: function '%s' takes %d argument(s), got %d\n",
+                     line, name, func->param_count, arg_count);
+        c->errors++;
+        return;
+    }
+
+    int base = c->next_register;
+    for (int i = 0; i < arg_count; i++) {
+        CompileExpression(c, args[i], AllocRegister(c), line);
+    }
+    EmitInstruction(c->chunk, op, (int)(func - c->symbols->functions), base, result, line);
+    FreeRegister(c, base);
+}
+
+// Returns a register holding the value of expr. Locals and call results
+// are used in place, anything else is evaluated into a new temporary.
+int CompileOperand(Compiler* c, const Expr* expr, int line) {
+    if (expr->kind == EXPR_VARIABLE) {
+        VariableRef ref = ResolveVariable(c, expr->name);
+        if (ref.depth == 1) return ref.slot;
+    }
+    if (expr->kind == EXPR_CALL) {
+        int result = c->next_call_slot++;
+        CompileCall(c, OP_CALL, expr->name, expr->args, expr->arg_count, result, line);
+        return result;
+    }
+    int reg = AllocRegister(c);
+    CompileExpression(c, expr, reg, line);
+    return reg;
+}
+
+// Type the checker proved expr always evaluates to, TYPE_UNKNOWN if none
+VarType ProvenType(const Expr* expr) {
+    return expr->kind == EXPR_LITERAL ? expr->type : expr->proven;
+}
+
+// Evaluates expr into register dst
+void CompileExpression(Compiler* c, const Expr* expr, int dst, int line) {
+    Chunk* chunk = c->chunk;
+    switch (expr->kind) {
+        case EXPR_LITERAL: {
+            int constant;
+            if (expr->type == TYPE_STRING) {
+                String* text = expr->value.stringValue;
+                constant = AddStringConstant(chunk, text->chars, text->length);
+            } else {
+                constant = AddConstant(chunk, expr->type, expr->value);
+            }
+            EmitInstruction(chunk, OP_LOADK, dst, constant, 0, line);
+            return;
+        }
+        case EXPR_VARIABLE: {
+            VariableRef ref = ResolveVariable(c, expr->name);
+            if (ref.depth == 1) {
+                if (ref.slot != dst) EmitInstruction(chunk, OP_MOVE, dst, ref.slot, 0, line);
+            } else if (ref.depth == 0) {
+                EmitInstruction(chunk, OP_GETGLOBAL, dst, ref.slot, 0, line);
+            } else {
+                // Undeclared names read as their own text
+                int text = AddStringConstant(chunk, expr->name, (int)strlen(expr->name));
+                EmitInstruction(chunk, OP_LOADK, dst, text, 0, line);
+            }
+            return;
+        }
+        case EXPR_CALL: {
+            int mark = c->next_register;
+            int result = CompileOperand(c, expr, line);
+            EmitInstruction(chunk, OP_MOVE, dst, result, 0, line);
+            FreeRegister(c, mark);
+            return;
+        }
+        case EXPR_UNARY: {
+            int mark = c->next_register;
+            int operand = CompileOperand(c, expr->left, line);
+            EmitInstruction(chunk, expr->op == OPR_NOT ? OP_NOT : OP_NEG, dst, operand, 0, line);
+            FreeRegister(c, mark);
+            return;
+        }
+        case EXPR_BINARY: {
+            if (expr->op == OPR_AND || expr->op == OPR_OR) {
+                // Short-circuit: the right operand only runs when the left
+                // one does not already decide the result
+                CompileExpression(c, expr->left, dst, line);
+                int skip = EmitInstruction(chunk, expr->op == OPR_AND ? OP_SKIP_AND : OP_SKIP_OR,
+                                           dst, 0, 0, line);
+                CompileExpression(c, expr->right, dst, line);
+                EmitInstruction(chunk, OP_CHECK_BOOL, dst, 0, expr->op == OPR_OR, line);
+                chunk->code[skip].b = chunk->count;
+                return;
+            }
+            int mark = c->next_register;
+            int left = CompileOperand(c, expr->left, line);
+            int right = CompileOperand(c, expr->right, line);
+            // Operands of proven types start out quickened
+            int op = expr->op - OPR_ADD;
+            VarType type = ProvenType(expr->left);
+            if (type == TYPE_INT && ProvenType(expr->right) == type) op += OP_ADD_II;
+            else if (type == TYPE_FLOAT && ProvenType(expr->right) == type) op += OP_ADD_FF;
+            else op += OP_ADD;
+            EmitInstruction(chunk, op, dst, left, right, line);
+            FreeRegister(c, mark);
+            return;
+        }
+    }
+}
+
+void CompileStatement(Compiler* c, const Stmt* stmt);
+
+// Marks the instruction at pc, if one was emitted, as where its line starts
+// running, for the profiler's execution counts
+void MarkLineStart(Compiler* c, int pc) {
+    if (pc < c->chunk->count) c->chunk->starts[pc] = 1;
+}
+
+void CompileBlock(Compiler* c, const Block* block) {
+    for (int i = 0; i < block->count; i++) {
+        const Stmt* stmt = block->items[i];
+        int start = c->chunk->count;
+        CompileStatement(c, stmt);
+        // A loop's line runs once per test of its condition instead
+        if (stmt->kind != STMT_WHILE && stmt->kind != STMT_FOR) MarkLineStart(c, start);
+    }
+}
+
+// Fuel a jump from at to target burns: the length of the loop it closes
+// when it goes backward, nothing when it goes forward
+int JumpCost(int at, int target) {
+    return target <= at ? at - target + 1 : 0;
+}
+
+// Sets the target of an unconditional jump
+void PatchJump(Compiler* c, int at, int target) {
+    c->chunk->code[at].b = target;
+    c->chunk->code[at].c = JumpCost(at, target);
+}
+
+// Emits OP_INCR_LOCAL or OP_INCR_GLOBAL for `x = x + k` and `x = x - k`
+// with an int constant k, to be followed by the generic store. Returns the
+// instruction to point past the store, or -1 for any other statement.
+int EmitIncrement(Compiler* c, const Stmt* stmt, VariableRef ref) {
+    const Expr* expr = stmt->expr;
+    if (expr->kind != EXPR_BINARY || (expr->op != OPR_ADD && expr->op != OPR_SUB)) return -1;
+    if (expr->left->kind != EXPR_VARIABLE || strcmp(expr->left->name, stmt->name) != 0) return -1;
+    if (expr->right->kind != EXPR_LITERAL || expr->right->type != TYPE_INT) return -1;
+    if (ref.type != TYPE_INT && ref.type != TYPE_UNKNOWN) return -1;
+    unsigned int step = (unsigned int)expr->right->value.intValue;
+    if (expr->op == OPR_SUB) step = 0u - step;
+    return EmitInstruction(c->chunk, ref.depth == 1 ? OP_INCR_LOCAL : OP_INCR_GLOBAL, ref.slot,
+                           (int)step, 0, stmt->line);
+}
+
+// Whether CompileExpression writes dst only once all operands are read.
+// && and || put their left operand in dst before evaluating the right.
+int WritesOnce(const Expr* expr) {
+    return expr->kind != EXPR_CALL &&
+           !(expr->kind == EXPR_BINARY && (expr->op == OPR_AND || expr->op == OPR_OR));
+}
+
+void CompileStore(Compiler* c, const Stmt* stmt) {
+    VariableRef ref = ResolveVariable(c, stmt->name);
+    if (ref.depth < 0) {
+        OutputFormat("Error: line %d: variable '%s' not found\n", stmt->line, stmt->name);
+        c->errors++;
+        return;
+    }
+
+    c->next_call_slot = c->locals.count;
+    int increment = EmitIncrement(c, stmt, ref);
+    int mark = c->next_register;
+    if (stmt->proven_store && ref.depth == 1 && WritesOnce(stmt->expr)) {
+        // A value proven to fit is computed straight into the local
+        CompileExpression(c, stmt->expr, ref.slot, stmt->line);
+    } else {
+        int value = CompileOperand(c, stmt->expr, stmt->line);
+        if (ref.depth == 1) {
+            EmitInstruction(c->chunk, OP_SETLOCAL, ref.slot, value, ref.type, stmt->line);
+        } else if (stmt->proven_store) {
+            EmitInstruction(c->chunk, OP_SETGLOBAL_TYPED, value, ref.slot, 0, stmt->line);
+        } else {
+            EmitInstruction(c->chunk, OP_SETGLOBAL, value, ref.slot, ref.type, stmt->line);
+        }
+    }
+    FreeRegister(c, mark);
+    if (increment >= 0) c->chunk->code[increment].c = c->chunk->count;
+}
+
+// The comparison that is true exactly when op is false. Comparisons are
+// three-way, even for NaN, so this holds for floats too.
+Operator NegateComparison(Operator op) {
+    switch (op) {
+        case OPR_EQ: return OPR_NE;
+        case OPR_NE: return OPR_EQ;
+        case OPR_LT: return OPR_GE;
+        case OPR_GT: return OPR_LE;
+        case OPR_LE: return OPR_GT;
+        default: return OPR_LT;
+    }
+}
+
+// Emits a fused compare-and-jump for a condition comparing a local with a
+// local or a constant, or a global with a constant, that jumps when the
+// condition equals when. The generic code for the condition and its jump
+// must follow; LinkCompareJump fills in the operands from it. Returns the
+// fused instruction, or -1 for a condition of any other shape.
+int EmitCompareJump(Compiler* c, const Expr* cond, int when, int line) {
+    if (cond->kind != EXPR_BINARY || cond->op < OPR_EQ || cond->op > OPR_GE) return -1;
+    if (cond->left->kind != EXPR_VARIABLE) return -1;
+    VariableRef left = ResolveVariable(c, cond->left->name);
+    const Expr* right = cond->right;
+    int form;
+    int operand = 0;
+    if (right->kind == EXPR_LITERAL && (right->type == TYPE_INT || right->type == TYPE_FLOAT)) {
+        if (left.depth < 0) return -1;
+        form = left.depth == 1 ? OP_JUMP_EQ_RK : OP_JUMP_EQ_GK;
+    } else if (right->kind == EXPR_VARIABLE && left.depth == 1) {
+        VariableRef ref = ResolveVariable(c, right->name);
+        if (ref.depth != 1) return -1;
+        form = OP_JUMP_EQ_RR;
+        operand = ref.slot;
+    } else {
+        return -1;
+    }
+    Operator op = when ? cond->op : NegateComparison(cond->op);
+    return EmitInstruction(c->chunk, form + (op - OPR_EQ), left.slot, operand, 0, line);
+}
+
+// Takes the constant of a fused compare-and-jump from the LOADK of the
+// generic code ending at jump, so both use the same one
+void LinkCompareJump(Compiler* c, int fused, int jump) {
+    if (fused >= 0 && c->chunk->code[fused].op >= OP_JUMP_EQ_RK) {
+        c->chunk->code[fused].b = c->chunk->code[jump - 2].b;
+    }
+}
+
+// Emits while and for loops in inverted form: the condition sits below
+// the body, so an iteration costs one conditional jump back to the top and
+// no unconditional one. A for loop passes its increment, a while loop NULL.
+void CompileLoop(Compiler* c, const Expr* condition, const Block* body,
+                 const Stmt* increment, int line) {
+    Chunk* chunk = c->chunk;
+    int enter = EmitInstruction(chunk, OP_JUMP, 0, 0, 0, line);
+    int top = chunk->count;
+    CompileBlock(c, body);
+    if (increment) CompileStore(c, increment);
+
+    PatchJump(c, enter, chunk->count);
+    int test = chunk->count;
+    c->next_call_slot = c->locals.count;
+    int fused = EmitCompareJump(c, condition, 1, line);
+    int mark = c->next_register;
+    int cond = CompileOperand(c, condition, line);
+    int back = chunk->count;
+    EmitInstruction(chunk, OP_JUMP_IF_TRUE, cond, top, JumpCost(back, top), line);
+    FreeRegister(c, mark);
+    LinkCompareJump(c, fused, back);
+    if (fused >= 0) chunk->code[fused].c = top;
+    MarkLineStart(c, test);
+}
+
+void CompileStatement(Compiler* c, const Stmt* stmt) {
+    Chunk* chunk = c->chunk;
+    int line = stmt->line;
+    // Call results of the previous statement are dead
+    c->next_call_slot = c->locals.count;
+
+    switch (stmt->kind) {
+        case STMT_DECLARE:
+        case STMT_ASSIGN:
+            CompileStore(c, stmt);
+            return;
+
+        case STMT_PRINT: {
+            int mark = c->next_register;
+            EmitInstruction(chunk, OP_PRINT, CompileOperand(c, stmt->expr, line), 0, 0, line);
+            FreeRegister(c, mark);
+            return;
+        }
+
+        case STMT_INPUT: {
+            VariableRef ref = ResolveVariable(c, stmt->name);
+            int name = InternName(&chunk->names, stmt->name);
+            if (ref.depth < 0) {
+                OutputFormat("Error: line %d: variable '%s' not found\n", line, stmt->name);
+                c->errors++;
+            } else if (ref.depth == 1) {
+                EmitInstruction(chunk, OP_INPUT_LOCAL, ref.slot, 0, name, line);
+            } else {
+                EmitInstruction(chunk, OP_INPUT_GLOBAL, 0, ref.slot, name, line);
+            }
+            return;
+        }
+
+        case STMT_IF: {
+            // A non-boolean condition skips both branches
+            int fused = EmitCompareJump(c, stmt->expr, 0, line);
+            int mark = c->next_register;
+            int cond = CompileOperand(c, stmt->expr, line);
+            int test = EmitInstruction(chunk, OP_JUMP_IF_FALSE, cond, 0, 0, line);
+            FreeRegister(c, mark);
+            LinkCompareJump(c, fused, test);
+            CompileBlock(c, &stmt->body);
+            if (stmt->else_body.count == 0) {
+                chunk->code[test].b = chunk->count;
+            } else {
+                int skip_else = EmitInstruction(chunk, OP_JUMP, 0, 0, 0, line);
+                chunk->code[test].b = chunk->count;
+                CompileBlock(c, &stmt->else_body);
+                PatchJump(c, skip_else, chunk->count);
+            }
+            chunk->code[test].c = chunk->count;
+            if (fused >= 0) chunk->code[fused].c = chunk->code[test].b;
+            return;
+        }
+
+        case STMT_WHILE:
+            CompileLoop(c, stmt->expr, &stmt->body, NULL, line);
+            return;
+
+        case STMT_FOR:
+            CompileStore(c, stmt->init);
+            CompileLoop(c, stmt->expr, &stmt->body, stmt->increment, line);
+            return;
+
+        case STMT_GOTO: {
+            int jump = EmitInstruction(chunk, OP_JUMP, 0, 0, 0, line);
+            PushGoto(c, stmt->name, jump, line);
+            return;
+        }
+
+        case STMT_LABEL: {
+            int id = InternName(&c->labels, stmt->name);
+            if (id >= c->label_pc_capacity) {
+                c->label_pc_capacity = c->labels.capacity;
+                c->label_pcs = realloc(c->label_pcs, c->label_pc_capacity * sizeof(int));
+            }
+            c->label_pcs[id] = chunk->count;
+            return;
+        }
+
+        case STMT_CALL:
+            CompileCall(c, OP_CALL, stmt->name, stmt->args, stmt->arg_count, -1, line);
+            return;
+
+        case STMT_RETURN: {
+            if (stmt->expr == NULL) {
+                EmitInstruction(chunk, OP_RETURN, 0, 0, 0, line);
+                return;
+            }
+            if (stmt->expr->kind == EXPR_CALL && c->in_function && c->tail_calls) {
+                const Expr* call = stmt->expr;
+                CompileCall(c, OP_TAILCALL, call->name, call->args, call->arg_count, 0, line);
+                return;
+            }
+            int mark = c->next_register;
+            EmitInstruction(chunk, OP_RETURN, CompileOperand(c, stmt->expr, line), 1, 0, line);
+            FreeRegister(c, mark);
+            return;
+        }
+
+        case STMT_EXIT: {
+            int text = AddStringConstant(chunk, stmt->text, (int)strlen(stmt->text));
+            EmitInstruction(chunk, OP_EXIT, 0, text, 0, line);
+            return;
+        }
+
+        case STMT_FUNCTION:
+            // Compiled separately after the top-level code
+            return;
+    }
+}
+
+// Points every goto of the finished function at its label
+void ResolveGotos(Compiler* c) {
+    for (int i = 0; i < c->goto_count; i++) {
+        LabelRef* ref = &c->gotos[i];
+        int id = LookupName(&c->labels, ref->name);
+        if (id < 0) {
+            OutputFormat("Error: line %d: label '%s' not found\n", ref->line, ref->name);
+            c->errors++;
+            continue;
+        }
+        PatchJump(c, ref->pc, c->label_pcs[id]);
+    }
+    ClearNameTable(&c->labels);
+    c->goto_count = 0;
+}
+
+// Compiles one function body or the top-level code. Returns the size of its
+// register window, laid out as parameters, locals, call results and then
+// temporaries. Everything before the temporaries is owned by the frame and
+// counted in *local_count.
+int CompileBody(Compiler* c, const Stmt* function, const Block* body, OpCode terminator,
+                int line, int* local_count) {
+    ClearNameTable(&c->locals);
+    for (int i = 0; function && i < function->param_count; i++) {
+        AddLocal(c, function->params[i], TYPE_UNKNOWN);
+    }
+    CollectDeclarations(c, body);
+    *local_count = c->locals.count + CountCalls(body);
+    c->next_register = *local_count;
+    c->max_register = *local_count;
+    CompileBlock(c, body);
+    // Falling off the end of a function runs its header line
+    int end = EmitInstruction(c->chunk, terminator, 0, 0, 0, line);
+    if (function) MarkLineStart(c, end);
+    ResolveGotos(c);
+    return c->max_register;
+}
+
+// Compiles the parsed program. The top-level code starts at instruction 0,
+// functions follow it. Top-level declarations become global slots, every
+// other declaration a register of its function.
+// With tail_calls, `return f(...)` inside a function reuses the caller's
+// frame; without, every call stays on the stack for full backtraces.
+Chunk* CompileProgram(Program* program, int tail_calls, int* errors) {
+    Compiler compiler = {0};
+    compiler.chunk = calloc(1, sizeof(Chunk));
+    compiler.symbols = &program->symbols;
+    compiler.tail_calls = tail_calls;
+
+    compiler.chunk->main_registers = CompileBody(&compiler, NULL, &program->main, OP_HALT, 0,
+                                                 &compiler.chunk->main_locals);
+
+    compiler.in_function = 1;
+    for (int i = 0; i < program->main.count; i++) {
+        const Stmt* stmt = program->main.items[i];
+        if (stmt->kind != STMT_FUNCTION) continue;
+        Function* func = FindFunction(compiler.symbols, stmt->name);
+        if (func == NULL || func->body != &stmt->body) continue;
+        func->entry = compiler.chunk->count;
+        func->register_count = CompileBody(&compiler, stmt, &stmt->body, OP_RETURN, stmt->line,
+                                           &func->local_count);
+        func->body = NULL;
+    }
+
+    // The chunk keeps its own copy of the function table, it outlives the
+    // tree. Nothing changes the chunk from here on, and with its strings
+    // frozen several VMs can run it at once.
+    Chunk* chunk = compiler.chunk;
+    FreezeStringTable(&chunk->strings);
+    chunk->function_count = program->symbols.function_names.count;
+    chunk->functions = malloc((chunk->function_count + 1) * sizeof(Function));
+    if (chunk->function_count > 0) {
+        memcpy(chunk->functions, program->symbols.functions, chunk->function_count * sizeof(Function));
+    }
+
+    FreeNameTable(&compiler.labels);
+    free(compiler.label_pcs);
+    free(compiler.gotos);
+    FreeNameTable(&compiler.locals);
+    free(compiler.local_types);
+    *errors = compiler.errors;
+    return compiler.chunk;
+}
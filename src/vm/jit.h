@@ -0,0 +1,937 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "bytecode.h"
+
+// Baseline JIT for x86-64 Linux. Loop headers (targets of backward jumps)
+// and function entries count how often control reaches them; once one
+// passes JIT_THRESHOLD the code from there to the end of its function is
+// translated to machine code, instruction by instruction, into mmap'd
+// memory.
+//
+// Native code keeps every value in the VM's own slots, so it can hand
+// control back to the interpreter before any instruction just by returning
+// that instruction's index. The types of the slots are worked out at
+// compile time from the types they hold on entry, which the native code
+// checks before running; instructions whose operand types are not known,
+// or that do anything but int, float and bool arithmetic, comparisons,
+// moves and branches, return to the interpreter instead. So do the error
+// cases (division by zero, type mismatches), which the interpreter then
+// runs and reports itself. Backward jumps burn the same fuel as in the
+// interpreter and return to it when the slice runs out, so budgets,
+// timeouts and sampling behave the same.
+//
+// Build with -DMINI_NO_JIT to leave it out.
+#if defined(__x86_64__) && defined(__linux__) && !defined(MINI_NO_JIT)
+#define VM_JIT_AVAILABLE 1
+#else
+#define VM_JIT_AVAILABLE 0
+#endif
+
+#if VM_JIT_AVAILABLE
+
+#include <sys/mman.h>
+
+#define JIT_THRESHOLD 1000      // Entries before a region is compiled
+#define JIT_MAX_FAILURES 16     // Failed entries in a row before it is dropped
+#define JIT_MAX_REGION 1024     // Instructions in one region
+#define JIT_MAX_SLOTS 256       // Slots one region may use
+#define JIT_MIN_NATIVE 4        // Instructions it must run before a region
+                                // is worth entering
+
+// Returns the index of the instruction the interpreter goes on with
+typedef int (*NativeCode)(Slot* R, Slot* G, volatile long long* fuel);
+
+typedef struct {
+    NativeCode native;
+    int count;              // Entries so far, -1 once compiled or given up
+    int failures;           // Entries in a row that failed their guards
+} JitEntry;
+
+typedef struct {
+    JitEntry* entries;      // One per instruction
+    void** maps;            // Executable memory of the compiled regions
+    size_t* map_sizes;
+    int map_count;
+    int map_capacity;
+} Jit;
+
+void StartJit(Jit* jit, const Chunk* chunk) {
+    memset(jit, 0, sizeof(*jit));
+    jit->entries = calloc(chunk->count > 0 ? chunk->count : 1, sizeof(JitEntry));
+}
+
+void FreeJit(Jit* jit) {
+    for (int i = 0; i < jit->map_count; i++) munmap(jit->maps[i], jit->map_sizes[i]);
+    free(jit->maps);
+    free(jit->map_sizes);
+    free(jit->entries);
+    memset(jit, 0, sizeof(*jit));
+}
+
+// Type sets of the analysis: one bit per VarType, plus one for a slot that
+// still holds whatever it held on entry
+#define JIT_TYPE(type) (1 << (type))
+#define JIT_ANY (JIT_TYPE(TYPE_INT) | JIT_TYPE(TYPE_FLOAT) | JIT_TYPE(TYPE_STRING) | \
+                 JIT_TYPE(TYPE_BOOL) | JIT_TYPE(TYPE_UNKNOWN))
+#define JIT_ENTRY (1 << 5)
+
+// x86 condition codes
+enum { JIT_CC_E = 0x4, JIT_CC_NE = 0x5, JIT_CC_A = 0x7, JIT_CC_L = 0xC, JIT_CC_GE = 0xD, JIT_CC_LE = 0xE, JIT_CC_G = 0xF };
+
+// Base registers of the native code: rdi holds R, rsi G and r8 the fuel,
+// which arrives in rdx but division needs that
+enum { JIT_RAX = 0, JIT_RCX = 1, JIT_RSI = 6, JIT_RDI = 7 };
+
+typedef struct {
+    int at;                 // Offset of the rel32 to patch
+    int target;             // Instruction it jumps to
+} JitPatch;
+
+typedef struct {
+    const Instruction* code;
+    const Slot* K;
+    const Slot* R;          // Slots on the first entry
+    const Slot* G;
+    int start, end;         // Instructions [start, end)
+    int keys[JIT_MAX_SLOTS];                // Register r is r, global g is -1 - g
+    int key_count;
+    unsigned char guarded[JIT_MAX_SLOTS];   // Type checked on entry
+    int wanted;             // A slot still holding its entry value was used
+    unsigned char* states;  // Type set of each slot before each instruction
+    unsigned char* reached;
+
+    unsigned char* bytes;   // Machine code
+    int length;
+    int capacity;
+    int* offsets;           // Native offset of each instruction
+    JitPatch* patches;
+    int patch_count;
+    int patch_capacity;
+} JitRegion;
+
+// Opcode classes
+
+int JitBinaryOperator(int op) {
+    if (op >= OP_ADD && op <= OP_GE) return op - OP_ADD;
+    if (op >= OP_ADD_II && op <= OP_GE_II) return op - OP_ADD_II;
+    if (op >= OP_ADD_FF && op <= OP_GE_FF) return op - OP_ADD_FF;
+    return -1;
+}
+
+int JitIsCompareJump(int op) {
+    return op >= OP_JUMP_EQ_RR && op <= OP_JUMP_GE_GK;
+}
+
+// 0 for RR, 1 for RK, 2 for GK
+int JitCompareForm(int op) {
+    return (op - OP_JUMP_EQ_RR) / 6;
+}
+
+// Generic instructions behind it, skipped when it does not jump
+int JitCompareTail(int op) {
+    return 2 + JitCompareForm(op);
+}
+
+// The comparison, OPR_EQ..OPR_GE
+int JitCompareOperator(int op) {
+    return OPR_EQ + (op - OP_JUMP_EQ_RR) % 6;
+}
+
+int JitGlobalKey(int index) {
+    return -1 - index;
+}
+
+// Slots an instruction touches
+int JitInstructionSlots(const Instruction* ins, int* keys) {
+    int op = ins->op;
+    if (JitBinaryOperator(op) >= 0) {
+        keys[0] = ins->a; keys[1] = ins->b; keys[2] = ins->c;
+        return 3;
+    }
+    if (JitIsCompareJump(op)) {
+        int form = JitCompareForm(op);
+        keys[0] = form == 2 ? JitGlobalKey(ins->a) : ins->a;
+        keys[1] = ins->b;
+        return form == 0 ? 2 : 1;
+    }
+    switch (op) {
+        case OP_LOADK:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_SKIP_AND:
+        case OP_SKIP_OR:
+        case OP_CHECK_BOOL:
+        case OP_INCR_LOCAL:
+            keys[0] = ins->a;
+            return 1;
+        case OP_INCR_GLOBAL:
+            keys[0] = JitGlobalKey(ins->a);
+            return 1;
+        case OP_MOVE:
+        case OP_SETLOCAL:
+        case OP_NOT:
+        case OP_NEG:
+            keys[0] = ins->a; keys[1] = ins->b;
+            return 2;
+        case OP_GETGLOBAL:
+        case OP_SETGLOBAL:
+        case OP_SETGLOBAL_TYPED:
+            keys[0] = ins->a; keys[1] = JitGlobalKey(ins->b);
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+int JitFindKey(const JitRegion* region, int key) {
+    for (int i = 0; i < region->key_count; i++) {
+        if (region->keys[i] == key) return i;
+    }
+    return -1;
+}
+
+VarType JitObservedType(const JitRegion* region, int slot) {
+    int key = region->keys[slot];
+    return key >= 0 ? region->R[key].type : region->G[-1 - key].type;
+}
+
+// Type of a slot the instruction needs to know, or -1. Asks for a guard
+// when the slot may still hold its entry value.
+int JitNeed(JitRegion* region, const unsigned char* state, int key) {
+    int slot = JitFindKey(region, key);
+    unsigned char set = state[slot];
+    if (set & JIT_ENTRY) {
+        if (!region->guarded[slot]) {
+            region->guarded[slot] = 1;
+            region->wanted = 1;
+        }
+        return -1;
+    }
+    for (int type = TYPE_INT; type <= TYPE_UNKNOWN; type++) {
+        if (set == JIT_TYPE(type)) return type;
+    }
+    return -1;
+}
+
+unsigned char JitSet(const JitRegion* region, const unsigned char* state, int key) {
+    return state[JitFindKey(region, key)];
+}
+
+// A copied slot: anything it held on entry is checked on the source
+unsigned char JitCopy(JitRegion* region, const unsigned char* state, int key) {
+    int slot = JitFindKey(region, key);
+    if (state[slot] & JIT_ENTRY) JitNeed(region, state, key);
+    return state[slot] & JIT_ENTRY ? JIT_ANY : state[slot];
+}
+
+void JitWrite(JitRegion* region, unsigned char* state, int key, unsigned char set) {
+    state[JitFindKey(region, key)] = set;
+}
+
+int JitIsNumber(int type) {
+    return type == TYPE_INT || type == TYPE_FLOAT;
+}
+
+// Type a checked store leaves in its target, or -1 if it is left to the
+// interpreter: type errors, strings and untyped values
+int JitStoreType(int declared, int target, int value) {
+    if (target < 0 || value < 0) return -1;
+    int type = declared;
+    if (type == TYPE_UNKNOWN) type = target;
+    if (type == TYPE_UNKNOWN) type = value;
+    if (value != type && !(type == TYPE_FLOAT && value == TYPE_INT)) return -1;
+    if (type == TYPE_STRING || type == TYPE_UNKNOWN || target == TYPE_STRING) return -1;
+    return type;
+}
+
+// Result type of a binary operator, or -1 for a type error
+int JitBinaryType(int operator, int x, int y) {
+    if (!JitIsNumber(x) || !JitIsNumber(y)) return -1;
+    if (operator >= OPR_EQ) return x == y ? TYPE_BOOL : -1;
+    return x == TYPE_INT && y == TYPE_INT ? TYPE_INT : TYPE_FLOAT;
+}
+
+// Operand types of a compare-and-jump: 1 when both are ints or both floats,
+// 0 when the tail instructions run instead, -1 when unknown
+int JitCompareTypes(JitRegion* region, const unsigned char* state, const Instruction* ins, int* type) {
+    int form = JitCompareForm(ins->op);
+    int x = JitNeed(region, state, form == 2 ? JitGlobalKey(ins->a) : ins->a);
+    int y = form == 0 ? JitNeed(region, state, ins->b) : (int)region->K[ins->b].type;
+    if (x < 0 || y < 0) return -1;
+    *type = x;
+    return x == y && JitIsNumber(x);
+}
+
+// Applies one instruction to the type sets in state and writes the
+// instructions it may go on with to next. Returns how many there are; an
+// instruction with none always returns to the interpreter.
+int JitStep(JitRegion* region, int pc, unsigned char* state, int* next) {
+    const Instruction* ins = &region->code[pc];
+    int op = ins->op;
+    int operator = JitBinaryOperator(op);
+    if (operator >= 0) {
+        int type = JitBinaryType(operator, JitNeed(region, state, ins->b), JitNeed(region, state, ins->c));
+        if (type < 0) return 0;
+        JitWrite(region, state, ins->a, JIT_TYPE(type));
+        next[0] = pc + 1;
+        return 1;
+    }
+    if (JitIsCompareJump(op)) {
+        int type;
+        int known = JitCompareTypes(region, state, ins, &type);
+        if (known < 0) return 0;
+        next[0] = pc + 1;
+        if (!known) return 1;
+        next[0] = ins->c;
+        next[1] = pc + 1 + JitCompareTail(op);
+        return 2;
+    }
+    int type;
+    switch (op) {
+        case OP_LOADK:
+            JitWrite(region, state, ins->a, JIT_TYPE(region->K[ins->b].type));
+            break;
+        case OP_MOVE:
+            JitWrite(region, state, ins->a, JitCopy(region, state, ins->b));
+            break;
+        case OP_GETGLOBAL:
+            JitWrite(region, state, ins->a, JitCopy(region, state, JitGlobalKey(ins->b)));
+            break;
+        case OP_SETGLOBAL_TYPED:
+            JitWrite(region, state, JitGlobalKey(ins->b), JitCopy(region, state, ins->a));
+            break;
+        case OP_SETLOCAL:
+            type = JitStoreType(ins->c, JitNeed(region, state, ins->a), JitNeed(region, state, ins->b));
+            if (type < 0) return 0;
+            JitWrite(region, state, ins->a, JIT_TYPE(type));
+            break;
+        case OP_SETGLOBAL:
+            type = JitStoreType(ins->c, JitNeed(region, state, JitGlobalKey(ins->b)),
+                                JitNeed(region, state, ins->a));
+            if (type < 0) return 0;
+            JitWrite(region, state, JitGlobalKey(ins->b), JIT_TYPE(type));
+            break;
+        case OP_NOT:
+            if (JitNeed(region, state, ins->b) != TYPE_BOOL) return 0;
+            JitWrite(region, state, ins->a, JIT_TYPE(TYPE_BOOL));
+            break;
+        case OP_NEG:
+            type = JitNeed(region, state, ins->b);
+            if (!JitIsNumber(type)) return 0;
+            JitWrite(region, state, ins->a, JIT_TYPE(type));
+            break;
+        case OP_JUMP:
+            next[0] = ins->b;
+            return 1;
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_SKIP_AND:
+        case OP_SKIP_OR:
+            if (JitNeed(region, state, ins->a) != TYPE_BOOL) return 0;
+            next[0] = ins->b;
+            next[1] = pc + 1;
+            return 2;
+        case OP_CHECK_BOOL:
+            if (JitNeed(region, state, ins->a) != TYPE_BOOL) return 0;
+            break;
+        case OP_INCR_LOCAL:
+        case OP_INCR_GLOBAL:
+            type = JitNeed(region, state, op == OP_INCR_GLOBAL ? JitGlobalKey(ins->a) : ins->a);
+            if (type < 0) return 0;
+            next[0] = type == TYPE_INT ? ins->c : pc + 1;
+            return 1;
+        default:
+            return 0;
+    }
+    next[0] = pc + 1;
+    return 1;
+}
+
+// Works out the type sets before every instruction reachable from the
+// start. Returns 0 when a guard was added and the analysis has to run again.
+int JitAnalyze(JitRegion* region) {
+    int count = region->end - region->start;
+    int width = region->key_count;
+    unsigned char* state = malloc(width + 1);
+    int* work = malloc(count * sizeof(int));
+    unsigned char* queued = calloc(count, 1);
+    int work_count = 0;
+    memset(region->reached, 0, count);
+    region->wanted = 0;
+
+    unsigned char* entry = region->states;
+    for (int i = 0; i < width; i++) {
+        entry[i] = region->guarded[i] ? JIT_TYPE(JitObservedType(region, i)) : JIT_ENTRY;
+    }
+    region->reached[0] = 1;
+    queued[0] = 1;
+    work[work_count++] = region->start;
+    while (work_count > 0) {
+        int pc = work[--work_count];
+        int next[2];
+        queued[pc - region->start] = 0;
+        memcpy(state, region->states + (pc - region->start) * width, width);
+        int next_count = JitStep(region, pc, state, next);
+        for (int i = 0; i < next_count; i++) {
+            int at = next[i] - region->start;
+            if (at < 0 || at >= count) continue;
+            unsigned char* target = region->states + at * width;
+            int changed = !region->reached[at];
+            if (changed) {
+                memcpy(target, state, width);
+                region->reached[at] = 1;
+            } else {
+                for (int k = 0; k < width; k++) {
+                    if ((target[k] | state[k]) != target[k]) {
+                        target[k] |= state[k];
+                        changed = 1;
+                    }
+                }
+            }
+            if (changed && !queued[at]) {
+                queued[at] = 1;
+                work[work_count++] = next[i];
+            }
+        }
+    }
+    free(state);
+    free(work);
+    free(queued);
+    return !region->wanted;
+}
+
+// Reached instructions that run natively rather than return at once
+int JitNativeCount(JitRegion* region) {
+    int count = 0;
+    unsigned char* state = malloc(region->key_count + 1);
+    for (int pc = region->start; pc < region->end; pc++) {
+        if (!region->reached[pc - region->start]) continue;
+        int next[2];
+        memcpy(state, region->states + (pc - region->start) * region->key_count, region->key_count);
+        if (JitStep(region, pc, state, next) > 0) count++;
+    }
+    free(state);
+    return count;
+}
+
+// Machine code
+
+void JitEmitByte(JitRegion* region, int byte) {
+    if (region->length >= region->capacity) {
+        region->capacity = region->capacity ? region->capacity * 2 : 4096;
+        region->bytes = realloc(region->bytes, region->capacity);
+    }
+    region->bytes[region->length++] = (unsigned char)byte;
+}
+
+void JitEmitBytes(JitRegion* region, const char* bytes, int count) {
+    for (int i = 0; i < count; i++) JitEmitByte(region, (unsigned char)bytes[i]);
+}
+
+void JitEmitInt32(JitRegion* region, unsigned int value) {
+    for (int i = 0; i < 4; i++) JitEmitByte(region, (value >> (8 * i)) & 0xFF);
+}
+
+// ModRM for [base + disp32]
+void JitEmitAddress(JitRegion* region, int reg, int base, int disp) {
+    JitEmitByte(region, 0x80 | (reg << 3) | base);
+    JitEmitInt32(region, (unsigned int)disp);
+}
+
+// Operand reg and [slot + offset] of an instruction
+void JitEmitSlotOp(JitRegion* region, const char* opcode, int count, int reg, int key, int offset) {
+    JitEmitBytes(region, opcode, count);
+    if (key >= 0) JitEmitAddress(region, reg, JIT_RDI, key * (int)sizeof(Slot) + offset);
+    else JitEmitAddress(region, reg, JIT_RSI, (-1 - key) * (int)sizeof(Slot) + offset);
+}
+
+#define JIT_VALUE_OFFSET ((int)offsetof(Slot, value))
+#define JIT_TYPE_OFFSET ((int)offsetof(Slot, type))
+
+// mov r32, [slot.value]
+void JitEmitLoadInt(JitRegion* region, int reg, int key) {
+    JitEmitSlotOp(region, "\x8B", 1, reg, key, JIT_VALUE_OFFSET);
+}
+
+// mov [slot.value], r32
+void JitEmitStoreInt(JitRegion* region, int reg, int key) {
+    JitEmitSlotOp(region, "\x89", 1, reg, key, JIT_VALUE_OFFSET);
+}
+
+// mov dword [slot.type], type
+void JitEmitStoreType(JitRegion* region, int key, int type) {
+    JitEmitSlotOp(region, "\xC7", 1, 0, key, JIT_TYPE_OFFSET);
+    JitEmitInt32(region, (unsigned int)type);
+}
+
+// Copies a value. Only strings need all eight bytes; the other types are
+// copied with the width they were stored with, so the load is forwarded
+// from the store instead of waiting for it.
+void JitEmitCopyValue(JitRegion* region, int target, int source, unsigned char set) {
+    int wide = (set & ~(JIT_TYPE(TYPE_INT) | JIT_TYPE(TYPE_FLOAT) | JIT_TYPE(TYPE_BOOL))) != 0;
+    const char* rex = wide ? "\x48" : "";
+    JitEmitBytes(region, rex, wide);
+    JitEmitSlotOp(region, "\x8B", 1, JIT_RAX, source, JIT_VALUE_OFFSET);
+    JitEmitBytes(region, rex, wide);
+    JitEmitSlotOp(region, "\x89", 1, JIT_RAX, target, JIT_VALUE_OFFSET);
+}
+
+// A whole slot, whose type set before the copy is set
+void JitEmitCopySlot(JitRegion* region, int target, int source, unsigned char set) {
+    JitEmitSlotOp(region, "\x8B", 1, JIT_RCX, source, JIT_TYPE_OFFSET);
+    JitEmitSlotOp(region, "\x89", 1, JIT_RCX, target, JIT_TYPE_OFFSET);
+    JitEmitCopyValue(region, target, source, set);
+}
+
+// movss xmm, [slot.value]
+void JitEmitLoadFloat(JitRegion* region, int xmm, int key) {
+    JitEmitSlotOp(region, "\xF3\x0F\x10", 3, xmm, key, JIT_VALUE_OFFSET);
+}
+
+// movss [slot.value], xmm
+void JitEmitStoreFloat(JitRegion* region, int xmm, int key) {
+    JitEmitSlotOp(region, "\xF3\x0F\x11", 3, xmm, key, JIT_VALUE_OFFSET);
+}
+
+// mov r32, imm32
+void JitEmitLoadImmediate(JitRegion* region, int reg, unsigned int value) {
+    JitEmitByte(region, 0xB8 + reg);
+    JitEmitInt32(region, value);
+}
+
+// cvtsi2ss xmm, eax
+void JitEmitIntToFloat(JitRegion* region, int xmm) {
+    JitEmitBytes(region, "\xF3\x0F\x2A", 3);
+    JitEmitByte(region, 0xC0 | (xmm << 3));
+}
+
+// Loads an int or float operand into xmm as a float; the slot key, or a
+// constant when constant is not NULL
+void JitEmitLoadNumber(JitRegion* region, int xmm, int type, int key, const Slot* constant) {
+    if (constant) {
+        JitEmitLoadImmediate(region, JIT_RAX, (unsigned int)constant->value.intValue);
+    } else if (type == TYPE_FLOAT) {
+        JitEmitLoadFloat(region, xmm, key);
+        return;
+    } else {
+        JitEmitLoadInt(region, JIT_RAX, key);
+    }
+    if (type == TYPE_INT) {
+        JitEmitIntToFloat(region, xmm);
+    } else {
+        // movd xmm, eax
+        JitEmitBytes(region, "\x66\x0F\x6E", 3);
+        JitEmitByte(region, 0xC0 | (xmm << 3));
+    }
+}
+
+// mov eax, pc; ret
+void JitEmitExit(JitRegion* region, int pc) {
+    JitEmitLoadImmediate(region, JIT_RAX, (unsigned int)pc);
+    JitEmitByte(region, 0xC3);
+}
+
+// Returns to the interpreter at pc when condition cc holds
+void JitEmitExitIf(JitRegion* region, int cc, int pc) {
+    JitEmitByte(region, 0x70 | (cc ^ 1));
+    JitEmitByte(region, 6);
+    JitEmitExit(region, pc);
+}
+
+int JitInside(const JitRegion* region, int pc) {
+    return pc >= region->start && pc < region->end;
+}
+
+// Jumps to target when cc holds, always when cc is -1. Targets outside the
+// region return to the interpreter at exit_pc instead.
+void JitEmitBranch(JitRegion* region, int cc, int target, int exit_pc) {
+    if (!JitInside(region, target)) {
+        if (cc < 0) JitEmitExit(region, exit_pc);
+        else JitEmitExitIf(region, cc, exit_pc);
+        return;
+    }
+    if (cc < 0) {
+        JitEmitByte(region, 0xE9);
+    } else {
+        JitEmitByte(region, 0x0F);
+        JitEmitByte(region, 0x80 | cc);
+    }
+    if (region->patch_count >= region->patch_capacity) {
+        region->patch_capacity = region->patch_capacity ? region->patch_capacity * 2 : 64;
+        region->patches = realloc(region->patches, region->patch_capacity * sizeof(JitPatch));
+    }
+    region->patches[region->patch_count].at = region->length;
+    region->patches[region->patch_count].target = target;
+    region->patch_count++;
+    JitEmitInt32(region, 0);
+}
+
+// A taken backward jump from pc: burns cost fuel, handing the jump back to
+// the interpreter when that would empty the slice, like VM_CHARGE
+void JitEmitBackwardJump(JitRegion* region, int pc, int cost, int target) {
+    if (!JitInside(region, target)) {
+        JitEmitExit(region, pc);
+        return;
+    }
+    JitEmitBytes(region, "\x49\x8B\x00", 3);  // mov rax, [r8]
+    JitEmitBytes(region, "\x48\x2D", 2);      // sub rax, cost
+    JitEmitInt32(region, (unsigned int)cost);
+    JitEmitExitIf(region, JIT_CC_LE, pc);
+    JitEmitBytes(region, "\x49\x89\x00", 3);  // mov [r8], rax
+    JitEmitBranch(region, -1, target, pc);
+}
+
+// Leaves the three-way comparison of xmm0 with xmm1 as 0 or 1 in al, the
+// same way as ApplyOperator, so NaN behaves the same
+void JitEmitFloatCompare(JitRegion* region, int operator) {
+    JitEmitBytes(region, "\x0F\x2E\xC1", 3);  // ucomiss xmm0, xmm1
+    JitEmitBytes(region, "\x0F\x97\xC0", 3);  // seta al: x > y
+    JitEmitBytes(region, "\x0F\x2E\xC8", 3);  // ucomiss xmm1, xmm0
+    JitEmitBytes(region, "\x0F\x97\xC1", 3);  // seta cl: x < y
+    switch (operator) {
+        case OPR_EQ: JitEmitBytes(region, "\x08\xC8\x34\x01", 4); break;  // or al, cl; xor al, 1
+        case OPR_NE: JitEmitBytes(region, "\x08\xC8", 2); break;          // or al, cl
+        case OPR_LT: JitEmitBytes(region, "\x88\xC8", 2); break;          // mov al, cl
+        case OPR_GT: break;
+        case OPR_LE: JitEmitBytes(region, "\x34\x01", 2); break;          // xor al, 1
+        default: JitEmitBytes(region, "\x88\xC8\x34\x01", 4); break;      // mov al, cl; xor al, 1
+    }
+}
+
+int JitIntCondition(int operator) {
+    static const int conditions[] = { JIT_CC_E, JIT_CC_NE, JIT_CC_L, JIT_CC_G, JIT_CC_LE, JIT_CC_GE };
+    return conditions[operator - OPR_EQ];
+}
+
+void JitEmitBinary(JitRegion* region, const Instruction* ins, int operator, int x, int y) {
+    if (x == TYPE_INT && y == TYPE_INT) {
+        JitEmitLoadInt(region, JIT_RAX, ins->b);
+        JitEmitLoadInt(region, JIT_RCX, ins->c);
+        switch (operator) {
+            case OPR_ADD: JitEmitBytes(region, "\x01\xC8", 2); break;      // add eax, ecx
+            case OPR_SUB: JitEmitBytes(region, "\x29\xC8", 2); break;      // sub eax, ecx
+            case OPR_MUL: JitEmitBytes(region, "\x0F\xAF\xC1", 3); break;  // imul eax, ecx
+            case OPR_DIV:
+                JitEmitBytes(region, "\x85\xC9", 2);  // test ecx, ecx
+                JitEmitExitIf(region, JIT_CC_E, (int)(ins - region->code));
+                // x / -1 wraps like ApplyOperator instead of trapping
+                JitEmitBytes(region, "\x83\xF9\xFF\x75\x04\xF7\xD8\xEB\x03", 9); // cmp ecx, -1; jne; neg eax; jmp
+                JitEmitBytes(region, "\x99\xF7\xF9", 3);  // cdq; idiv ecx
+                break;
+            default:
+                JitEmitBytes(region, "\x39\xC8\x0F", 3);  // cmp eax, ecx; setcc al
+                JitEmitByte(region, 0x90 | JitIntCondition(operator));
+                JitEmitBytes(region, "\xC0\x0F\xB6\xC0", 4);  // movzx eax, al
+                break;
+        }
+    } else {
+        JitEmitLoadNumber(region, 0, x, ins->b, NULL);
+        JitEmitLoadNumber(region, 1, y, ins->c, NULL);
+        switch (operator) {
+            case OPR_ADD: JitEmitBytes(region, "\xF3\x0F\x58\xC1", 4); break;  // addss xmm0, xmm1
+            case OPR_SUB: JitEmitBytes(region, "\xF3\x0F\x5C\xC1", 4); break;  // subss xmm0, xmm1
+            case OPR_MUL: JitEmitBytes(region, "\xF3\x0F\x59\xC1", 4); break;  // mulss xmm0, xmm1
+            case OPR_DIV:
+                // xorps xmm2, xmm2; ucomiss xmm1, xmm2; jp/jne past the exit
+                JitEmitBytes(region, "\x0F\x57\xD2\x0F\x2E\xCA\x7A\x08\x75\x06", 10);
+                JitEmitExit(region, (int)(ins - region->code));
+                JitEmitBytes(region, "\xF3\x0F\x5E\xC1", 4);  // divss xmm0, xmm1
+                break;
+            default:
+                JitEmitFloatCompare(region, operator);
+                JitEmitBytes(region, "\x0F\xB6\xC0", 3);  // movzx eax, al
+                break;
+        }
+        if (operator < OPR_EQ) {
+            JitEmitStoreFloat(region, 0, ins->a);
+            JitEmitStoreType(region, ins->a, TYPE_FLOAT);
+            return;
+        }
+    }
+    JitEmitStoreInt(region, JIT_RAX, ins->a);
+    JitEmitStoreType(region, ins->a, JitBinaryType(operator, x, y));
+}
+
+void JitEmitCompareJump(JitRegion* region, int pc, const Instruction* ins, int type) {
+    int form = JitCompareForm(ins->op);
+    int operator = JitCompareOperator(ins->op);
+    int left = form == 2 ? JitGlobalKey(ins->a) : ins->a;
+    const Slot* constant = form == 0 ? NULL : &region->K[ins->b];
+    int skip = pc + 1 + JitCompareTail(ins->op);
+    int cc;
+    if (type == TYPE_INT) {
+        JitEmitLoadInt(region, JIT_RAX, left);
+        if (constant) JitEmitLoadImmediate(region, JIT_RCX, (unsigned int)constant->value.intValue);
+        else JitEmitLoadInt(region, JIT_RCX, ins->b);
+        JitEmitBytes(region, "\x39\xC8", 2);  // cmp eax, ecx
+        cc = JitIntCondition(operator);
+    } else {
+        JitEmitLoadNumber(region, 0, TYPE_FLOAT, left, NULL);
+        JitEmitLoadNumber(region, 1, TYPE_FLOAT, ins->b, constant);
+        JitEmitFloatCompare(region, operator);
+        JitEmitBytes(region, "\x84\xC0", 2);  // test al, al
+        cc = JIT_CC_NE;
+    }
+    JitEmitBranch(region, cc ^ 1, skip, skip);
+    if (ins->c <= pc) JitEmitBackwardJump(region, pc, pc - ins->c + 1, ins->c);
+    else JitEmitBranch(region, -1, ins->c, ins->c);
+}
+
+// Native code for the instruction at pc, given the type sets before it
+void JitEmitInstruction(JitRegion* region, int pc, unsigned char* state) {
+    const Instruction* ins = &region->code[pc];
+    int op = ins->op;
+    int operator = JitBinaryOperator(op);
+    int type;
+    if (operator >= 0) {
+        int x = JitNeed(region, state, ins->b);
+        int y = JitNeed(region, state, ins->c);
+        if (JitBinaryType(operator, x, y) < 0) JitEmitExit(region, pc);
+        else JitEmitBinary(region, ins, operator, x, y);
+        return;
+    }
+    if (JitIsCompareJump(op)) {
+        int known = JitCompareTypes(region, state, ins, &type);
+        if (known < 0) JitEmitExit(region, pc);
+        else if (known) JitEmitCompareJump(region, pc, ins, type);
+        return;
+    }
+    switch (op) {
+        case OP_LOADK: {
+            const Slot* constant = &region->K[ins->b];
+            if (constant->type == TYPE_STRING) {
+                unsigned long long bits = (unsigned long long)(size_t)constant->value.stringValue;
+                JitEmitBytes(region, "\x48\xB8", 2);  // mov rax, imm64
+                JitEmitInt32(region, (unsigned int)bits);
+                JitEmitInt32(region, (unsigned int)(bits >> 32));
+                JitEmitSlotOp(region, "\x48\x89", 2, JIT_RAX, ins->a, JIT_VALUE_OFFSET);
+            } else {
+                JitEmitSlotOp(region, "\xC7", 1, 0, ins->a, JIT_VALUE_OFFSET);  // mov dword [slot.value], k
+                JitEmitInt32(region, (unsigned int)constant->value.intValue);
+            }
+            JitEmitStoreType(region, ins->a, constant->type);
+            return;
+        }
+        case OP_MOVE:
+            JitEmitCopySlot(region, ins->a, ins->b, JitSet(region, state, ins->b));
+            return;
+        case OP_GETGLOBAL:
+            JitEmitCopySlot(region, ins->a, JitGlobalKey(ins->b), JitSet(region, state, JitGlobalKey(ins->b)));
+            return;
+        case OP_SETGLOBAL_TYPED:
+            JitEmitCopySlot(region, JitGlobalKey(ins->b), ins->a, JitSet(region, state, ins->a));
+            return;
+        case OP_SETLOCAL:
+        case OP_SETGLOBAL: {
+            int target = op == OP_SETLOCAL ? ins->a : JitGlobalKey(ins->b);
+            int value = op == OP_SETLOCAL ? ins->b : ins->a;
+            int value_type = JitNeed(region, state, value);
+            type = JitStoreType(ins->c, JitNeed(region, state, target), value_type);
+            if (type < 0) {
+                JitEmitExit(region, pc);
+                return;
+            }
+            if (type == TYPE_FLOAT && value_type == TYPE_INT) {
+                JitEmitLoadNumber(region, 0, TYPE_INT, value, NULL);
+                JitEmitStoreFloat(region, 0, target);
+            } else {
+                JitEmitCopyValue(region, target, value, JIT_TYPE(type));
+            }
+            JitEmitStoreType(region, target, type);
+            return;
+        }
+        case OP_NOT:
+            if (JitNeed(region, state, ins->b) != TYPE_BOOL) {
+                JitEmitExit(region, pc);
+                return;
+            }
+            JitEmitLoadInt(region, JIT_RAX, ins->b);
+            JitEmitBytes(region, "\x85\xC0\x0F\x94\xC0\x0F\xB6\xC0", 8);  // test; sete al; movzx
+            JitEmitStoreInt(region, JIT_RAX, ins->a);
+            JitEmitStoreType(region, ins->a, TYPE_BOOL);
+            return;
+        case OP_NEG:
+            type = JitNeed(region, state, ins->b);
+            if (!JitIsNumber(type)) {
+                JitEmitExit(region, pc);
+                return;
+            }
+            JitEmitLoadInt(region, JIT_RAX, ins->b);
+            if (type == TYPE_INT) JitEmitBytes(region, "\xF7\xD8", 2);  // neg eax
+            else JitEmitBytes(region, "\x35\x00\x00\x00\x80", 5);       // xor eax, sign bit
+            JitEmitStoreInt(region, JIT_RAX, ins->a);
+            JitEmitStoreType(region, ins->a, type);
+            return;
+        case OP_JUMP:
+            if (ins->c) JitEmitBackwardJump(region, pc, ins->c, ins->b);
+            else JitEmitBranch(region, -1, ins->b, ins->b);
+            return;
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_SKIP_AND:
+        case OP_SKIP_OR:
+            if (JitNeed(region, state, ins->a) != TYPE_BOOL) {
+                JitEmitExit(region, pc);
+                return;
+            }
+            JitEmitLoadInt(region, JIT_RAX, ins->a);
+            JitEmitBytes(region, "\x85\xC0", 2);  // test eax, eax
+            if (op == OP_JUMP_IF_TRUE) {
+                JitEmitBranch(region, JIT_CC_E, pc + 1, pc + 1);
+                JitEmitBackwardJump(region, pc, ins->c, ins->b);
+            } else {
+                JitEmitBranch(region, op == OP_SKIP_OR ? JIT_CC_NE : JIT_CC_E, ins->b, ins->b);
+            }
+            return;
+        case OP_CHECK_BOOL:
+            if (JitNeed(region, state, ins->a) != TYPE_BOOL) JitEmitExit(region, pc);
+            return;
+        case OP_INCR_LOCAL:
+        case OP_INCR_GLOBAL: {
+            int key = op == OP_INCR_GLOBAL ? JitGlobalKey(ins->a) : ins->a;
+            type = JitNeed(region, state, key);
+            if (type < 0) {
+                JitEmitExit(region, pc);
+            } else if (type == TYPE_INT) {
+                JitEmitSlotOp(region, "\x81", 1, 0, key, JIT_VALUE_OFFSET);  // add dword [slot], b
+                JitEmitInt32(region, (unsigned int)ins->b);
+                JitEmitBranch(region, -1, ins->c, ins->c);
+            }
+            return;
+        }
+        default:
+            JitEmitExit(region, pc);
+            return;
+    }
+}
+
+// Copies the code into its own executable mapping
+NativeCode JitInstall(Jit* jit, JitRegion* region) {
+    size_t page = 4096;
+    size_t size = ((size_t)region->length + page - 1) / page * page;
+    void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return NULL;
+    memcpy(memory, region->bytes, region->length);
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        return NULL;
+    }
+    if (jit->map_count >= jit->map_capacity) {
+        jit->map_capacity = jit->map_capacity ? jit->map_capacity * 2 : 16;
+        jit->maps = realloc(jit->maps, jit->map_capacity * sizeof(void*));
+        jit->map_sizes = realloc(jit->map_sizes, jit->map_capacity * sizeof(size_t));
+    }
+    jit->maps[jit->map_count] = memory;
+    jit->map_sizes[jit->map_count] = size;
+    jit->map_count++;
+    return (NativeCode)memory;
+}
+
+void FreeJitRegion(JitRegion* region) {
+    free(region->states);
+    free(region->reached);
+    free(region->bytes);
+    free(region->offsets);
+    free(region->patches);
+}
+
+// Compiles the code from start to the end of its function, taking the
+// types R and G hold now as the ones to expect. Returns NULL if nothing
+// there can run natively.
+NativeCode CompileRegion(Jit* jit, const Chunk* chunk, const Instruction* code, int start,
+                         const Slot* R, const Slot* G) {
+    JitRegion region;
+    memset(&region, 0, sizeof(region));
+    region.code = code;
+    region.K = chunk->constants;
+    region.R = R;
+    region.G = G;
+    region.start = start;
+    region.end = chunk->count;
+    for (int i = 0; i < chunk->function_count; i++) {
+        int entry = chunk->functions[i].entry;
+        if (entry > start && entry < region.end) region.end = entry;
+    }
+    if (region.end - start > JIT_MAX_REGION) region.end = start + JIT_MAX_REGION;
+
+    // Stop before the first instruction that would need too many slots
+    for (int pc = start; pc < region.end; pc++) {
+        int keys[3];
+        int count = JitInstructionSlots(&code[pc], keys);
+        int added = 0;
+        for (int i = 0; i < count; i++) {
+            if (JitFindKey(&region, keys[i]) < 0) added++;
+        }
+        if (region.key_count + added > JIT_MAX_SLOTS) {
+            region.end = pc;
+            break;
+        }
+        for (int i = 0; i < count; i++) {
+            if (JitFindKey(&region, keys[i]) < 0) region.keys[region.key_count++] = keys[i];
+        }
+    }
+    int count = region.end - start;
+    if (count <= 0) return NULL;
+
+    region.states = malloc((size_t)count * (region.key_count + 1));
+    region.reached = malloc(count);
+    while (!JitAnalyze(&region)) {}
+    if (JitNativeCount(&region) < JIT_MIN_NATIVE) {
+        FreeJitRegion(&region);
+        return NULL;
+    }
+
+    JitEmitBytes(&region, "\x49\x89\xD0", 3);  // mov r8, rdx
+    // Guards on the slots whose entry types the code relies on
+    for (int i = 0; i < region.key_count; i++) {
+        if (!region.guarded[i]) continue;
+        // cmp dword [slot.type], type
+        JitEmitSlotOp(&region, "\x81", 1, 7, region.keys[i], JIT_TYPE_OFFSET);
+        JitEmitInt32(&region, (unsigned int)JitObservedType(&region, i));
+        JitEmitExitIf(&region, JIT_CC_NE, start);
+    }
+    region.offsets = malloc(count * sizeof(int));
+    for (int pc = start; pc < region.end; pc++) {
+        region.offsets[pc - start] = region.length;
+        if (region.reached[pc - start]) JitEmitInstruction(&region, pc, region.states + (pc - start) * region.key_count);
+        else JitEmitExit(&region, pc);
+    }
+    JitEmitExit(&region, region.end);
+    for (int i = 0; i < region.patch_count; i++) {
+        const JitPatch* patch = &region.patches[i];
+        int target = region.offsets[patch->target - start];
+        unsigned int relative = (unsigned int)(target - (patch->at + 4));
+        for (int b = 0; b < 4; b++) region.bytes[patch->at + b] = (relative >> (8 * b)) & 0xFF;
+    }
+
+    NativeCode native = JitInstall(jit, &region);
+    FreeJitRegion(&region);
+    return native;
+}
+
+// Called where control reaches a loop header or function entry pc. Counts
+// the entry, compiles the code there once it is hot and runs it. Returns
+// the instruction the interpreter goes on with, pc itself if nothing ran.
+int JitRun(Jit* jit, const Chunk* chunk, const Instruction* code, int pc, Slot* R, Slot* G,
+           volatile long long* fuel) {
+    JitEntry* entry = &jit->entries[pc];
+    if (entry->native == NULL) {
+        if (entry->count < 0 || ++entry->count < JIT_THRESHOLD) return pc;
+        entry->count = -1;
+        entry->native = CompileRegion(jit, chunk, code, pc, R, G);
+        if (entry->native == NULL) return pc;
+    }
+    int next = entry->native(R, G, fuel);
+    if (next != pc) {
+        entry->failures = 0;
+    } else if (++entry->failures >= JIT_MAX_FAILURES) {
+        // The types it was compiled for keep changing
+        entry->native = NULL;
+    }
+    return next;
+}
+
+#endif
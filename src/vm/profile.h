@@ -0,0 +1,284 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "bytecode.h"
+#include "../commands/output.h"
+#include "../proccess_command/source.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Execution profile of one run, filled in by the instrumented copy of the
+// dispatch loop. Every instruction charges the ticks since the previous
+// one to its line and to the function running it (exclusive time). Calls
+// charge their whole duration to the calling line and to the callee
+// (inclusive time), once per recursion so recursive functions are not
+// counted twice.
+
+// Cheapest clock available: the time stamp counter on x86, nanoseconds
+// elsewhere. Ticks are converted to time with the run's wall clock.
+unsigned long long ProfileTicks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ull + now.tv_nsec;
+#endif
+}
+
+typedef struct {
+    long long count;                // Times its statement started
+    unsigned long long self;        // Ticks spent in its own instructions
+    unsigned long long outer_self;  // Part of self not inside its own calls
+    unsigned long long calls;       // Ticks spent in calls made from it
+    long long allocations;
+    int active;                     // Calls from it still running
+} LineProfile;
+
+typedef struct {
+    long long calls;
+    unsigned long long self;
+    unsigned long long inclusive;
+    long long allocations;
+    int active;                     // Activations still running
+} FunctionProfile;
+
+typedef struct {
+    int line;                       // Line of the call
+    int function;                   // Function running in this frame
+    unsigned long long call_start;
+    unsigned long long function_start;
+} ProfileFrame;
+
+typedef struct {
+    LineProfile* lines;             // Indexed by source line
+    int line_count;
+    FunctionProfile* functions;     // Indexed by function id, the last
+    int function_count;             // entry is the top-level code
+    ProfileFrame* frames;
+    int frame_count;
+    int frame_capacity;
+    int line;                       // Line of the previous instruction
+    int function;                   // Function running now
+    unsigned long long last;        // Ticks at the previous instruction
+    long long last_allocations;
+    long long instructions;         // Instructions dispatched
+    unsigned long long start;
+    unsigned long long ticks;       // Ticks of the whole run
+    double seconds;                 // Wall clock time of the whole run
+    double wall_start;
+} Profile;
+
+void FreeProfile(Profile* profile) {
+    free(profile->lines);
+    free(profile->functions);
+    free(profile->frames);
+    memset(profile, 0, sizeof(*profile));
+}
+
+// seconds is the wall clock at the start of the run
+void StartProfile(Profile* profile, const Chunk* chunk, long long allocations, double seconds) {
+    FreeProfile(profile);
+    int max_line = 0;
+    for (int i = 0; i < chunk->count; i++) {
+        if (chunk->lines[i] > max_line) max_line = chunk->lines[i];
+    }
+    profile->line_count = max_line + 1;
+    profile->lines = calloc(profile->line_count, sizeof(LineProfile));
+    profile->function_count = chunk->function_count + 1;
+    profile->functions = calloc(profile->function_count, sizeof(FunctionProfile));
+    profile->function = chunk->function_count;
+    profile->functions[profile->function].calls = 1;
+    profile->functions[profile->function].active = 1;
+    profile->line = 0;
+    profile->last_allocations = allocations;
+    profile->wall_start = seconds;
+    profile->start = profile->last = ProfileTicks();
+}
+
+// Charges the time since the previous instruction, then moves to line.
+// start says the instruction begins a run of the line's statement, which
+// control coming back from a call or around a loop body does not.
+void ProfileStep(Profile* profile, int line, int start, long long allocations) {
+    unsigned long long now = ProfileTicks();
+    unsigned long long elapsed = now - profile->last;
+    long long allocated = allocations - profile->last_allocations;
+    LineProfile* previous = &profile->lines[profile->line];
+    FunctionProfile* function = &profile->functions[profile->function];
+    previous->self += elapsed;
+    if (previous->active == 0) previous->outer_self += elapsed;
+    previous->allocations += allocated;
+    function->self += elapsed;
+    function->allocations += allocated;
+    profile->last = now;
+    profile->last_allocations = allocations;
+    profile->instructions++;
+    profile->lines[line].count += start;
+    profile->line = line;
+}
+
+void ProfileCall(Profile* profile, int function, int line) {
+    if (profile->frame_count >= profile->frame_capacity) {
+        profile->frame_capacity = profile->frame_capacity ? profile->frame_capacity * 2 : 64;
+        profile->frames = realloc(profile->frames, profile->frame_capacity * sizeof(ProfileFrame));
+    }
+    ProfileFrame* frame = &profile->frames[profile->frame_count++];
+    frame->line = line;
+    frame->function = function;
+    frame->call_start = frame->function_start = ProfileTicks();
+    profile->lines[line].active++;
+    profile->functions[function].active++;
+    profile->functions[function].calls++;
+    profile->function = function;
+}
+
+void EndFunctionProfile(Profile* profile, int function, unsigned long long start, unsigned long long now) {
+    if (--profile->functions[function].active == 0) {
+        profile->functions[function].inclusive += now - start;
+    }
+}
+
+// The frame now runs function instead of the one it was called for
+void ProfileTailCall(Profile* profile, int function) {
+    ProfileFrame* frame = &profile->frames[profile->frame_count - 1];
+    unsigned long long now = ProfileTicks();
+    EndFunctionProfile(profile, frame->function, frame->function_start, now);
+    frame->function = function;
+    frame->function_start = now;
+    profile->functions[function].active++;
+    profile->functions[function].calls++;
+    profile->function = function;
+}
+
+void ProfileReturn(Profile* profile) {
+    ProfileFrame* frame = &profile->frames[--profile->frame_count];
+    unsigned long long now = ProfileTicks();
+    EndFunctionProfile(profile, frame->function, frame->function_start, now);
+    if (--profile->lines[frame->line].active == 0) {
+        profile->lines[frame->line].calls += now - frame->call_start;
+    }
+    profile->function = profile->frame_count > 0 ? profile->frames[profile->frame_count - 1].function
+                                                 : profile->function_count - 1;
+}
+
+// Closes the frames still running when the script stops; seconds is the
+// wall clock at the end of the run
+void FinishProfile(Profile* profile, long long allocations, double seconds) {
+    ProfileStep(profile, profile->line, 0, allocations);
+    profile->instructions--;
+    while (profile->frame_count > 0) ProfileReturn(profile);
+    profile->ticks = ProfileTicks() - profile->start;
+    profile->functions[profile->function_count - 1].inclusive = profile->ticks;
+    profile->seconds = seconds - profile->wall_start;
+}
+
+unsigned long long LineInclusive(const LineProfile* line) {
+    return line->outer_self + line->calls;
+}
+
+// Self and inclusive time come from different clock reads, keep them
+// consistent
+unsigned long long FunctionInclusive(const FunctionProfile* function) {
+    return function->inclusive > function->self ? function->inclusive : function->self;
+}
+
+double ProfileMilliseconds(const Profile* profile, unsigned long long ticks) {
+    if (profile->ticks == 0) return 0.0;
+    return ticks * 1000.0 * profile->seconds / profile->ticks;
+}
+
+const char* ProfileFunctionName(const Chunk* chunk, int function) {
+    return function < chunk->function_count ? chunk->functions[function].name : "<main>";
+}
+
+// qsort has no context argument
+_Thread_local const Profile* sorted_profile;
+
+int CompareLineProfiles(const void* x, const void* y) {
+    const LineProfile* a = &sorted_profile->lines[*(const int*)x];
+    const LineProfile* b = &sorted_profile->lines[*(const int*)y];
+    return a->self < b->self ? 1 : a->self > b->self ? -1 : 0;
+}
+
+int CompareFunctionProfiles(const void* x, const void* y) {
+    const FunctionProfile* a = &sorted_profile->functions[*(const int*)x];
+    const FunctionProfile* b = &sorted_profile->functions[*(const int*)y];
+    return a->inclusive < b->inclusive ? 1 : a->inclusive > b->inclusive ? -1 : 0;
+}
+
+#define PROFILE_REPORT_LINES 20
+
+// Prints the hottest lines by exclusive time and every function that ran
+// by inclusive time to the current output. lines, when given, are the
+// script's source lines for quoting.
+void WriteProfileReport(const Profile* profile, const Chunk* chunk, const LineView* lines, int line_count) {
+    double total = profile->ticks ? (double)profile->ticks : 1.0;
+    int* order = malloc((profile->line_count + profile->function_count) * sizeof(int));
+    int count = 0;
+    // Line 0 only holds the time before the first instruction
+    for (int i = 1; i < profile->line_count; i++) {
+        if (profile->lines[i].count || profile->lines[i].self) order[count++] = i;
+    }
+    sorted_profile = profile;
+    qsort(order, count, sizeof(int), CompareLineProfiles);
+
+    OutputFormat("Profile: %.3f ms, %llu ticks, %lld instructions\n", profile->seconds * 1000.0,
+                 profile->ticks, profile->instructions);
+    OutputFormat("\n  %%self   self ms   incl ms      count   allocs  line\n");
+    for (int i = 0; i < count && i < PROFILE_REPORT_LINES; i++) {
+        const LineProfile* line = &profile->lines[order[i]];
+        OutputFormat("%6.1f%% %9.3f %9.3f %10lld %8lld  %d", 100.0 * line->self / total,
+                     ProfileMilliseconds(profile, line->self),
+                     ProfileMilliseconds(profile, LineInclusive(line)),
+                     line->count, line->allocations, order[i]);
+        if (lines && order[i] >= 1 && order[i] <= line_count) {
+            const LineView* text = &lines[order[i] - 1];
+            int length = text->length < 40 ? text->length : 40;
+            while (length > 0 && (text->start[length - 1] == '\r' || text->start[length - 1] == ' ')) length--;
+            OutputFormat(": %.*s", length, text->start);
+        }
+        OutputFormat("\n");
+    }
+
+    count = 0;
+    for (int i = 0; i < profile->function_count; i++) {
+        if (profile->functions[i].calls) order[count++] = i;
+    }
+    qsort(order, count, sizeof(int), CompareFunctionProfiles);
+    OutputFormat("\n  %%incl   self ms   incl ms      calls   allocs  function\n");
+    for (int i = 0; i < count; i++) {
+        const FunctionProfile* function = &profile->functions[order[i]];
+        OutputFormat("%6.1f%% %9.3f %9.3f %10lld %8lld  %s\n", 100.0 * FunctionInclusive(function) / total,
+                     ProfileMilliseconds(profile, function->self),
+                     ProfileMilliseconds(profile, FunctionInclusive(function)),
+                     function->calls, function->allocations, ProfileFunctionName(chunk, order[i]));
+    }
+    free(order);
+}
+
+// Writes every line and function that ran as tab-separated values. Returns
+// 0 if the file could not be written.
+int WriteProfileData(const Profile* profile, const Chunk* chunk, const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) return 0;
+    fprintf(file, "kind\tname\tcount\tself_ticks\tinclusive_ticks\tallocations\n");
+    fprintf(file, "total\t-\t1\t%llu\t%llu\t0\n", profile->ticks, profile->ticks);
+    for (int i = 0; i < profile->line_count; i++) {
+        const LineProfile* line = &profile->lines[i];
+        if (!line->count && !line->self) continue;
+        fprintf(file, "line\t%d\t%lld\t%llu\t%llu\t%lld\n", i, line->count, line->self,
+                LineInclusive(line), line->allocations);
+    }
+    for (int i = 0; i < profile->function_count; i++) {
+        const FunctionProfile* function = &profile->functions[i];
+        if (!function->calls) continue;
+        fprintf(file, "function\t%s\t%lld\t%llu\t%llu\t%lld\n", ProfileFunctionName(chunk, i),
+                function->calls, function->self, FunctionInclusive(function), function->allocations);
+    }
+    return fclose(file) == 0;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "../variable/string_pool.h"
+
+// Counts of sampled script call stacks in the folded format flame graph
+// tools read: one line per distinct stack, frames outermost first and
+// separated by semicolons, then a space and the number of samples.
+
+#define SAMPLE_INTERVAL_US 1000
+#define SAMPLE_MAX_DEPTH 128
+
+typedef struct {
+    String* stack;
+    long long count;
+} FoldedStack;
+
+typedef struct {
+    FoldedStack* entries;   // Open addressing, stack NULL marks empty
+    int count;
+    int capacity;           // Always a power of two
+    long long samples;
+    char* text;             // Scratch space a stack is built in
+    int text_length;
+    int text_capacity;
+} Sampler;
+
+void ClearSampleText(Sampler* sampler) {
+    sampler->text_length = 0;
+}
+
+void AppendSampleText(Sampler* sampler, const char* text, int length) {
+    if (sampler->text_length + length + 1 > sampler->text_capacity) {
+        int capacity = sampler->text_capacity ? sampler->text_capacity : 256;
+        while (capacity < sampler->text_length + length + 1) capacity *= 2;
+        sampler->text = realloc(sampler->text, capacity);
+        sampler->text_capacity = capacity;
+    }
+    memcpy(sampler->text + sampler->text_length, text, length);
+    sampler->text_length += length;
+}
+
+void InsertFoldedStack(Sampler* sampler, String* stack, long long count) {
+    unsigned int mask = sampler->capacity - 1;
+    unsigned int i = stack->hash & mask;
+    while (sampler->entries[i].stack) i = (i + 1) & mask;
+    sampler->entries[i].stack = stack;
+    sampler->entries[i].count = count;
+}
+
+// Counts one sample of the stack built in the scratch text
+void AddSample(Sampler* sampler) {
+    const char* text = sampler->text;
+    int length = sampler->text_length;
+    unsigned int hash = HashChars(text, length);
+    sampler->samples++;
+    if (sampler->capacity > 0) {
+        unsigned int mask = sampler->capacity - 1;
+        for (unsigned int i = hash & mask; sampler->entries[i].stack; i = (i + 1) & mask) {
+            String* stack = sampler->entries[i].stack;
+            if (stack->hash == hash && stack->length == length && memcmp(stack->chars, text, length) == 0) {
+                sampler->entries[i].count++;
+                return;
+            }
+        }
+    }
+
+    // Keep the load factor at or below one half
+    if ((sampler->count + 1) * 2 > sampler->capacity) {
+        FoldedStack* old = sampler->entries;
+        int old_capacity = sampler->capacity;
+        sampler->capacity = old_capacity ? old_capacity * 2 : 64;
+        sampler->entries = calloc(sampler->capacity, sizeof(FoldedStack));
+        for (int i = 0; i < old_capacity; i++) {
+            if (old[i].stack) InsertFoldedStack(sampler, old[i].stack, old[i].count);
+        }
+        free(old);
+    }
+    InsertFoldedStack(sampler, NewString(text, length), 1);
+    sampler->count++;
+}
+
+// Returns 0 if the file could not be written
+int WriteFoldedStacks(const Sampler* sampler, const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) return 0;
+    for (int i = 0; i < sampler->capacity; i++) {
+        const FoldedStack* entry = &sampler->entries[i];
+        if (entry->stack) fprintf(file, "%s %lld\n", entry->stack->chars, entry->count);
+    }
+    return fclose(file) == 0;
+}
+
+void FreeSampler(Sampler* sampler) {
+    for (int i = 0; i < sampler->capacity; i++) {
+        ReleaseString(sampler->entries[i].stack);
+    }
+    free(sampler->entries);
+    free(sampler->text);
+    memset(sampler, 0, sizeof(*sampler));
+}
@@ -0,0 +1,498 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/time.h>
+#include "../variable/symbol_table.h"
+#include "../operates/expression.h"
+#include "../commands/print.h"
+#include "bytecode.h"
+#include "profile.h"
+#include "sampler.h"
+#include "jit.h"
+
+#define DEFAULT_CALL_DEPTH 10000
+#define MAX_INPUT_LENGTH 512
+#define VM_FUEL_SLICE 1000000
+
+// Threaded dispatch where the compiler supports labels as values, a plain
+// switch everywhere else. Build with -DMINI_NO_COMPUTED_GOTO to force the
+// switch.
+#if defined(__GNUC__) && !defined(MINI_NO_COMPUTED_GOTO)
+#define VM_COMPUTED_GOTO 1
+#else
+#define VM_COMPUTED_GOTO 0
+#endif
+
+// Activation records live in one contiguous register stack. A callee's
+// window starts where the caller evaluated its arguments, so the arguments
+// are already in place as parameters and a call copies nothing.
+typedef struct {
+    Instruction* return_ip;
+    int base;
+    int local_count;
+    int result;             // Absolute register for the return value, or -1
+    int function;           // Function running above this frame
+} CallFrame;
+
+// Limits on how much work a script may do
+typedef struct {
+    long long instruction_limit;    // 0 for no limit
+    double timeout_seconds;         // 0 for no deadline
+    int max_call_depth;             // 0 for DEFAULT_CALL_DEPTH
+} ExecutionLimits;
+
+// State of one virtual machine. Backward jumps charge the length of the
+// loop they close and calls charge one, so the fuel burnt approximates the
+// instructions executed. RunChunk only decrements fuel; when a slice runs
+// out RefuelVM checks the limits and hands out the next slice. The sampling
+// profiler takes the rest of the fuel to get the same call.
+typedef struct {
+    Slot* registers;
+    int register_capacity;
+    CallFrame* frames;
+    int frame_capacity;
+    int frame_count;
+    FILE* input;                    // Where input statements read from
+    long long allocations;          // Heap allocations made while running
+    Profile* profile;               // Filled in by the run when not NULL
+    Sampler* sampler;               // Sampled during the run when not NULL
+    const Chunk* chunk;             // Chunk being run
+    Instruction* code;              // The VM's own copy of the chunk's code,
+    int code_capacity;              // quickened while it runs
+    ExecutionLimits limits;
+    volatile long long fuel;        // Also zeroed by the sampling signal
+    long long stolen_fuel;          // Fuel the signal took
+    volatile sig_atomic_t sample_pending;
+    long long fuel_slice;           // Size of the slice fuel was refilled to
+    long long fuel_used;            // Fuel burnt in earlier slices
+    double deadline;
+    int no_jit;                     // Interpret everything
+#if VM_JIT_AVAILABLE
+    Jit jit;                        // Native code of the current run
+#endif
+} VM;
+
+void InitVM(VM* vm, const ExecutionLimits* limits) {
+    memset(vm, 0, sizeof(*vm));
+    vm->input = stdin;
+    if (limits) vm->limits = *limits;
+    if (vm->limits.max_call_depth <= 0) vm->limits.max_call_depth = DEFAULT_CALL_DEPTH;
+}
+
+void FreeVM(VM* vm) {
+    free(vm->registers);
+    free(vm->frames);
+    free(vm->code);
+    memset(vm, 0, sizeof(*vm));
+}
+
+double MonotonicSeconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+void GiveFuel(VM* vm) {
+    vm->fuel_slice = VM_FUEL_SLICE;
+    long long limit = vm->limits.instruction_limit;
+    if (limit > 0 && limit - vm->fuel_used < vm->fuel_slice) vm->fuel_slice = limit - vm->fuel_used;
+    vm->fuel = vm->fuel_slice;
+}
+
+void StartBudget(VM* vm) {
+    vm->fuel_used = 0;
+    double timeout = vm->limits.timeout_seconds;
+    vm->deadline = timeout > 0 ? MonotonicSeconds() + timeout : 0.0;
+    GiveFuel(vm);
+}
+
+void SampleStack(VM* vm, int line);
+
+// Called when the fuel drops to zero. Returns 0 when the script must stop.
+int RefuelVM(VM* vm, int line) {
+    if (vm->sample_pending) {
+        vm->sample_pending = 0;
+        SampleStack(vm, line);
+        vm->fuel += vm->stolen_fuel;
+        vm->stolen_fuel = 0;
+        if (vm->fuel > 0) return 1;
+    }
+    vm->fuel_used += vm->fuel_slice - vm->fuel;
+    long long limit = vm->limits.instruction_limit;
+    if (limit > 0 && vm->fuel_used >= limit) {
+        OutputFormat("Error: line %d: instruction budget of %lld exhausted\n", line, limit);
+        return 0;
+    }
+    if (vm->deadline > 0 && MonotonicSeconds() >= vm->deadline) {
+        OutputFormat("Error: line %d: time limit of %g seconds exceeded\n", line, vm->limits.timeout_seconds);
+        return 0;
+    }
+    GiveFuel(vm);
+    return 1;
+}
+
+// The run being sampled. SIGPROF is process wide, so only one run at a
+// time can be sampled.
+VM* volatile sampled_vm = NULL;
+
+// Hands the rest of the fuel to the sampler, so the VM stops at its next
+// backward jump or call to record where it is. Nothing is added to the
+// dispatch loop.
+void SampleSignal(int signal_number) {
+    (void)signal_number;
+    VM* vm = sampled_vm;
+    if (vm == NULL) return;
+    vm->stolen_fuel += vm->fuel;
+    vm->fuel = 0;
+    vm->sample_pending = 1;
+}
+
+void AppendSampleFrame(Sampler* sampler, const char* name, int line) {
+    char text[64];
+    if (sampler->text_length > 0) AppendSampleText(sampler, ";", 1);
+    AppendSampleText(sampler, name, (int)strlen(name));
+    text[0] = ':';
+    AppendSampleText(sampler, text, 1 + FormatInt(line, text + 1));
+}
+
+// Records the script call stack, each frame with the line it is at
+void SampleStack(VM* vm, int line) {
+    Sampler* sampler = vm->sampler;
+    const Chunk* chunk = vm->chunk;
+    if (sampler == NULL) return;
+    ClearSampleText(sampler);
+    for (int depth = 0; depth <= vm->frame_count; depth++) {
+        if (depth == SAMPLE_MAX_DEPTH - 1 && depth < vm->frame_count) {
+            AppendSampleText(sampler, ";...", 4);
+            depth = vm->frame_count;
+        }
+        const char* name = depth == 0 ? "<main>" : chunk->functions[vm->frames[depth - 1].function].name;
+        int at = depth == vm->frame_count ? line
+                                          : chunk->lines[vm->frames[depth].return_ip - 1 - vm->code];
+        AppendSampleFrame(sampler, name, at);
+    }
+    AddSample(sampler);
+}
+
+// Samples the run every SAMPLE_INTERVAL_US of CPU time into vm->sampler
+void StartSampling(VM* vm) {
+    sampled_vm = vm;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = SampleSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, NULL);
+    struct itimerval timer = { { 0, SAMPLE_INTERVAL_US }, { 0, SAMPLE_INTERVAL_US } };
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+void StopSampling(VM* vm) {
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    signal(SIGPROF, SIG_IGN);
+    sampled_vm = NULL;
+    vm->sample_pending = 0;
+    vm->stolen_fuel = 0;
+}
+
+// Returns 0 once the call depth limit is reached
+int PushFrame(VM* vm) {
+    if (vm->frame_count >= vm->limits.max_call_depth) return 0;
+    if (vm->frame_count >= vm->frame_capacity) {
+        vm->frame_capacity = vm->frame_capacity ? vm->frame_capacity * 2 : 64;
+        if (vm->frame_capacity > vm->limits.max_call_depth) vm->frame_capacity = vm->limits.max_call_depth;
+        vm->frames = realloc(vm->frames, vm->frame_capacity * sizeof(CallFrame));
+        vm->allocations++;
+    }
+    vm->frame_count++;
+    return 1;
+}
+
+void EnsureRegisters(VM* vm, int count) {
+    if (count <= vm->register_capacity) return;
+    int capacity = vm->register_capacity ? vm->register_capacity : 64;
+    while (capacity < count) capacity *= 2;
+    vm->registers = realloc(vm->registers, capacity * sizeof(Slot));
+    vm->allocations++;
+    memset(vm->registers + vm->register_capacity, 0, (capacity - vm->register_capacity) * sizeof(Slot));
+    vm->register_capacity = capacity;
+}
+
+// Stores an evaluated value into a variable slot. type is the declared
+// type; TYPE_UNKNOWN keeps the slot's current type, or takes the value's
+// type on the first store.
+void StoreSlot(Slot* target, VarType type, const Slot* value) {
+    if (type == TYPE_UNKNOWN) type = target->type;
+    if (type == TYPE_UNKNOWN) type = value->type;
+
+    // Type checking
+    if (value->type != type && !(type == TYPE_FLOAT && value->type == TYPE_INT)) {
+        OutputFormat("Type mismatch\n");
+        return;
+    }
+
+    // Handle type conversions
+    Value result = value->value;
+    if (type == TYPE_FLOAT && value->type == TYPE_INT) {
+        result.floatValue = (float)value->value.intValue;
+    } else if (type == TYPE_STRING) {
+        RetainString(result.stringValue);
+    }
+    if (target->type == TYPE_STRING) ReleaseString(target->value.stringValue);
+    target->type = type;
+    target->value = result;
+}
+
+void ReadSlot(VM* vm, Slot* target, const char* name) {
+    char input_buffer[MAX_INPUT_LENGTH];
+    OutputFormat("Enter value for %s: ", name);
+    FlushOutput();
+    if (fgets(input_buffer, sizeof(input_buffer), vm->input) == NULL) {
+        OutputFormat("Error reading input\n");
+        return;
+    }
+    input_buffer[strcspn(input_buffer, "\n")] = '\0';
+
+    switch (target->type) {
+        case TYPE_INT:
+            target->value.intValue = atoi(input_buffer);
+            break;
+        case TYPE_FLOAT:
+            target->value.floatValue = atof(input_buffer);
+            break;
+        case TYPE_STRING:
+            ReleaseString(target->value.stringValue);
+            target->value.stringValue = NewString(input_buffer, (int)strlen(input_buffer));
+            vm->allocations++;
+            break;
+        case TYPE_BOOL:
+            if (strcmp(input_buffer, "true") == 0) target->value.boolValue = 1;
+            else if (strcmp(input_buffer, "false") == 0) target->value.boolValue = 0;
+            else OutputFormat("Invalid boolean value\n");
+            break;
+        default:
+            OutputFormat("Unsupported type\n");
+    }
+}
+
+// Global slots start out holding the default value of their declared type
+Slot* CreateGlobals(const Chunk* chunk) {
+    Slot* globals = calloc(chunk->globals.count + 1, sizeof(Slot));
+    String* empty = NewString("", 0);
+    for (int i = 0; i < chunk->globals.count; i++) {
+        globals[i].type = chunk->global_types[i];
+        if (globals[i].type == TYPE_STRING) globals[i].value.stringValue = RetainString(empty);
+    }
+    ReleaseString(empty);
+    return globals;
+}
+
+void FreeSlots(Slot* slots, int count) {
+    for (int i = 0; i < count; i++) {
+        if (slots[i].type == TYPE_STRING) ReleaseString(slots[i].value.stringValue);
+        slots[i].type = TYPE_UNKNOWN;
+    }
+}
+
+void PrintSlot(const Slot* slot) {
+    switch (slot->type) {
+        case TYPE_INT: PrintInt(slot->value.intValue); break;
+        case TYPE_FLOAT: PrintFloat(slot->value.floatValue); break;
+        case TYPE_STRING: Print(slot->value.stringValue->chars); break;
+        case TYPE_BOOL: PrintBool(slot->value.boolValue); break;
+        default: break;
+    }
+}
+
+// Gives the VM a fresh copy of the chunk's code to quicken. Chunks are
+// shared between batch workers and may be mapped read-only from the cache,
+// so the VM never writes to them.
+Instruction* CopyCode(VM* vm, const Chunk* chunk) {
+    if (chunk->count > vm->code_capacity) {
+        vm->code_capacity = chunk->count;
+        vm->code = realloc(vm->code, vm->code_capacity * sizeof(Instruction));
+        vm->allocations++;
+    }
+    memcpy(vm->code, chunk->code, chunk->count * sizeof(Instruction));
+    return vm->code;
+}
+
+// Rewrites a generic binary instruction into its form for the operand
+// types, when there is one
+void QuickenBinary(Instruction* ins, VarType x, VarType y) {
+    if (x != y) return;
+    if (x == TYPE_INT) ins->op = OP_ADD_II + (ins->op - OP_ADD);
+    else if (x == TYPE_FLOAT) ins->op = OP_ADD_FF + (ins->op - OP_ADD);
+}
+
+// Generic operator path for anything the inline fast paths do not cover
+void BinarySlow(Slot* dst, Operator op, const Slot* x, const Slot* y) {
+    Value result = ApplyOperator(op, &dst->type, x->type, x->value, y->type, y->value);
+    dst->value = result;
+}
+
+#if VM_COMPUTED_GOTO
+#define VM_LABEL_ADDRESS(name, a, b, c) &&L_##name,
+#define VM_SWITCH() goto *dispatch_table[ip->op];
+#define VM_CASE(name) L_##name:
+#define VM_DISPATCH() VM_STEP(); goto *dispatch_table[ip->op]
+#define VM_END
+#else
+#define VM_SWITCH() for (;;) switch (ip->op) {
+#define VM_CASE(name) case name:
+#define VM_DISPATCH() VM_STEP(); continue
+#define VM_END }
+#endif
+
+// A generic binary instruction quickens itself on the types it sees, then
+// applies the operator through ApplyOperator this once
+#define VM_BINARY(opcode, operator)                                           \
+    VM_CASE(opcode) {                                                         \
+        Slot* x = &R[ip->b];                                                  \
+        Slot* y = &R[ip->c];                                                  \
+        QuickenBinary(ip, x->type, y->type);                                  \
+        BinarySlow(&R[ip->a], operator, x, y);                                \
+        ip++;                                                                 \
+        VM_DISPATCH();                                                        \
+    }
+
+// Quickened forms only check that the types still match and otherwise go
+// back to the generic instruction, which runs next
+#define VM_DEOPTIMIZE(generic)                                                \
+    ip->op = generic;                                                         \
+    VM_DISPATCH()
+
+// Integer arithmetic wraps around
+#define VM_ARITHMETIC_II(opcode, generic, expr)                               \
+    VM_CASE(opcode) {                                                         \
+        Slot* x = &R[ip->b];                                                  \
+        Slot* y = &R[ip->c];                                                  \
+        if (x->type != TYPE_INT || y->type != TYPE_INT) { VM_DEOPTIMIZE(generic); } \
+        unsigned int u = (unsigned int)x->value.intValue;                     \
+        unsigned int v = (unsigned int)y->value.intValue;                     \
+        R[ip->a].value.intValue = (int)(expr);                                \
+        R[ip->a].type = TYPE_INT;                                             \
+        ip++;                                                                 \
+        VM_DISPATCH();                                                        \
+    }
+
+#define VM_ARITHMETIC_FF(opcode, generic, op)                                 \
+    VM_CASE(opcode) {                                                         \
+        Slot* x = &R[ip->b];                                                  \
+        Slot* y = &R[ip->c];                                                  \
+        if (x->type != TYPE_FLOAT || y->type != TYPE_FLOAT) { VM_DEOPTIMIZE(generic); } \
+        R[ip->a].value.floatValue = x->value.floatValue op y->value.floatValue; \
+        R[ip->a].type = TYPE_FLOAT;                                           \
+        ip++;                                                                 \
+        VM_DISPATCH();                                                        \
+    }
+
+// Comparisons go through the same three-way result as ApplyOperator, so
+// NaN compares the same in every form
+#define VM_COMPARISON(opcode, generic, slot_type, field, cmp)                 \
+    VM_CASE(opcode) {                                                         \
+        Slot* x = &R[ip->b];                                                  \
+        Slot* y = &R[ip->c];                                                  \
+        if (x->type != slot_type || y->type != slot_type) { VM_DEOPTIMIZE(generic); } \
+        int order = (x->value.field > y->value.field) - (x->value.field < y->value.field); \
+        R[ip->a].value.boolValue = order cmp 0;                               \
+        R[ip->a].type = TYPE_BOOL;                                            \
+        ip++;                                                                 \
+        VM_DISPATCH();                                                        \
+    }
+
+// x = x + k on an int, skipping the generic store that follows
+#define VM_INCREMENT(opcode, slot)                                            \
+    VM_CASE(opcode) {                                                         \
+        Slot* x = &slot;                                                      \
+        if (x->type != TYPE_INT) {                                            \
+            ip++;                                                             \
+            VM_DISPATCH();                                                    \
+        }                                                                     \
+        x->value.intValue = (int)((unsigned int)x->value.intValue + (unsigned int)ip->b); \
+        ip = code + ip->c;                                                    \
+        VM_DISPATCH();                                                        \
+    }
+
+// Fused compare-and-jump. Only ints and floats compared with their own type
+// are handled here, anything else runs the generic code of the tail
+// instructions that follow. A taken backward jump burns the length of the
+// loop it closes, like the jump it stands for.
+#define VM_COMPARE_JUMP(opcode, left, right, cmp, tail)                       \
+    VM_CASE(opcode) {                                                         \
+        const Slot* x = &left;                                                \
+        const Slot* y = &right;                                               \
+        int order;                                                            \
+        if (x->type == TYPE_INT && y->type == TYPE_INT) {                     \
+            order = (x->value.intValue > y->value.intValue) - (x->value.intValue < y->value.intValue); \
+        } else if (x->type == TYPE_FLOAT && y->type == TYPE_FLOAT) {          \
+            order = (x->value.floatValue > y->value.floatValue) - (x->value.floatValue < y->value.floatValue); \
+        } else {                                                              \
+            ip++;                                                             \
+            VM_DISPATCH();                                                    \
+        }                                                                     \
+        if (order cmp 0) {                                                    \
+            int at = (int)(ip - code);                                        \
+            if (ip->c <= at) {                                                \
+                VM_CHARGE(at - ip->c + 1);                                    \
+                ip = code + ip->c;                                            \
+                VM_LOOP_ENTRY();                                              \
+            } else {                                                          \
+                ip = code + ip->c;                                            \
+            }                                                                 \
+        } else {                                                              \
+            ip += 1 + (tail);                                                 \
+        }                                                                     \
+        VM_DISPATCH();                                                        \
+    }
+
+#define VM_COMPARE_JUMPS(name, cmp)                                           \
+    VM_COMPARE_JUMP(OP_JUMP_##name##_RR, R[ip->a], R[ip->b], cmp, 2)          \
+    VM_COMPARE_JUMP(OP_JUMP_##name##_RK, R[ip->a], K[ip->b], cmp, 3)          \
+    VM_COMPARE_JUMP(OP_JUMP_##name##_GK, G[ip->a], K[ip->b], cmp, 4)
+
+// Burns fuel for a backward jump or call, stopping once the budget is gone
+#define VM_CHARGE(cost)                                                       \
+    if ((vm->fuel -= (cost)) <= 0 && !RefuelVM(vm, chunk->lines[ip - code])) goto stop
+
+#define VM_LOOP_NAME RunChunkPlain
+#define VM_PROFILING 0
+#define VM_JIT 0
+#include "vm_loop.h"
+
+#define VM_LOOP_NAME RunChunkProfiled
+#define VM_PROFILING 1
+#define VM_JIT 0
+#include "vm_loop.h"
+
+#if VM_JIT_AVAILABLE
+#define VM_LOOP_NAME RunChunkJit
+#define VM_PROFILING 0
+#define VM_JIT 1
+#include "vm_loop.h"
+#endif
+
+// Runs compiled code from instruction 0 until OP_HALT or OP_EXIT. Returns 0
+// if the script was stopped by one of the VM's limits. The loop is picked
+// once per run, so the plain one never checks for a profile. A profiled
+// run counts every instruction and so never uses the JIT.
+int RunChunk(VM* vm, const Chunk* chunk) {
+    vm->chunk = chunk;
+    CopyCode(vm, chunk);
+    if (vm->profile) return RunChunkProfiled(vm, chunk);
+#if VM_JIT_AVAILABLE
+    if (!vm->no_jit) {
+        StartJit(&vm->jit, chunk);
+        int status = RunChunkJit(vm, chunk);
+        FreeJit(&vm->jit);
+        return status;
+    }
+#endif
+    return RunChunkPlain(vm, chunk);
+}
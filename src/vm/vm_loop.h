@@ -0,0 +1,358 @@
+// The dispatch loop, included by vm.h once for each copy it needs. The
+// includer defines VM_LOOP_NAME as the function name, VM_PROFILING as 1
+// for the copy that records a profile and VM_JIT as 1 for the copy that
+// hands hot code to the JIT; the plain copy has neither, so running
+// without them costs nothing.
+
+#if VM_PROFILING
+#define VM_STEP() ProfileStep(vm->profile, chunk->lines[ip - code], chunk->starts[ip - code], vm->allocations)
+#else
+#define VM_STEP()
+#endif
+
+// Control just reached a loop header or function entry
+#if VM_JIT
+#define VM_LOOP_ENTRY() ip = code + JitRun(&vm->jit, chunk, code, (int)(ip - code), R, G, &vm->fuel)
+#else
+#define VM_LOOP_ENTRY()
+#endif
+
+int VM_LOOP_NAME(VM* vm, const Chunk* chunk) {
+#if VM_COMPUTED_GOTO
+    static void* dispatch_table[] = { OPCODE_LIST(VM_LABEL_ADDRESS) };
+#endif
+    Instruction* code = vm->code;
+    Instruction* ip = code;
+    const Slot* K = chunk->constants;
+    int base = 0;
+    int frame_local_count = chunk->main_locals;
+    Slot* G = CreateGlobals(chunk);
+
+    const Function* functions = chunk->functions;
+    int status = 1;
+    EnsureRegisters(vm, chunk->main_registers);
+    Slot* R = vm->registers;
+    for (int i = 0; i < frame_local_count; i++) R[i].type = TYPE_UNKNOWN;
+    StartBudget(vm);
+    if (vm->sampler) StartSampling(vm);
+#if VM_PROFILING
+    StartProfile(vm->profile, chunk, vm->allocations, MonotonicSeconds());
+#endif
+
+    VM_STEP();
+    VM_SWITCH()
+
+    VM_CASE(OP_LOADK) {
+        R[ip->a] = K[ip->b];
+        ip++;
+        VM_DISPATCH();
+    }
+
+    VM_CASE(OP_MOVE) {
+        R[ip->a] = R[ip->b];
+        ip++;
+        VM_DISPATCH();
+    }
+
+    VM_CASE(OP_GETGLOBAL) {
+        R[ip->a] = G[ip->b];
+        ip++;
+        VM_DISPATCH();
+    }
+
+    VM_CASE(OP_SETGLOBAL) {
+        StoreSlot(&G[ip->b], (VarType)ip->c, &R[ip->a]);
+        ip++;
+        VM_DISPATCH();
+    }
+
+    VM_CASE(OP_SETGLOBAL_TYPED) {
+        // Never a string, so there is no reference to move
+        G[ip->b] = R[ip->a];
+        ip++;
+        VM_DISPATCH();
+    }
+
+    VM_CASE(OP_SETLOCAL) {
+        StoreSlot(&R[ip->a], (VarType)ip->c, &R[ip->b]);
+        ip++;
+        VM_DISPATCH();
+    }
+
+    VM_BINARY(OP_ADD, OPR_ADD)
+    VM_BINARY(OP_SUB, OPR_SUB)
+    VM_BINARY(OP_MUL, OPR_MUL)
+    VM_BINARY(OP_DIV, OPR_DIV)
+    VM_BINARY(OP_EQ, OPR_EQ)
+    VM_BINARY(OP_NE, OPR_NE)
+    VM_BINARY(OP_LT, OPR_LT)
+    VM_BINARY(OP_GT, OPR_GT)
+    VM_BINARY(OP_LE, OPR_LE)
+    VM_BINARY(OP_GE, OPR_GE)
+
+    VM_CASE(OP_NOT)
+    VM_CASE(OP_NEG) {
+        Slot* x = &R[ip->b];
+        Value result = ApplyUnary(ip->op == OP_NOT ? OPR_NOT : OPR_NEG, &R[ip->a].type, x->type, x->value);
+        R[ip->a].value = result;
+        ip++;
+        VM_DISPATCH();
+    }
+
+    VM_CASE(OP_JUMP) {
+        // Only backward jumps (goto cycles) cost fuel
+        if (ip->c) {
+            VM_CHARGE(ip->c);
+            ip = code + ip->b;
+            VM_LOOP_ENTRY();
+        } else {
+            ip = code + ip->b;
+        }
+        VM_DISPATCH();
+    }
+
+    VM_CASE(OP_JUMP_IF_FALSE) {
+        Slot* cond = &R[ip->a];
+        if (cond->type != TYPE_BOOL) {
+            OutputFormat("Condition must be boolean\n");
+            ip = code + ip->c;
+        } else if (!cond->value.boolValue) {
+            ip = code + ip->b;
+        } else {
+            ip++;
+        }
+        VM_DISPATCH();
+    }
+
+    VM_CASE(OP_JUMP_IF_TRUE) {
+        Slot* cond = &R[ip->a];
+        if (cond->type == TYPE_BOOL && cond->value.boolValue) {
+            VM_CHARGE(ip->c);
+            ip = code + ip->b;
+            VM_LOOP_ENTRY();
+        } else {
+            if (cond->type != TYPE_BOOL) OutputFormat("Condition must be boolean\n");
+            ip++;
+        }
+        VM_DISPATCH();
+    }
+
+    VM_CASE(OP_SKIP_AND)
+    VM_CASE(OP_SKIP_OR) {
+        Slot* x = &R[ip->a];
+        if (x->type != TYPE_BOOL) {
+            OutputFormat("Type mismatch for '%s' operator\n", ip->op == OP_SKIP_OR ? "||" : "&&");
+            x->type = TYPE_UNKNOWN;
+            ip = code + ip->b;
+        } else if (x->value.boolValue == (ip->op == OP_SKIP_OR)) {
+            ip = code + ip->b;
+        } else {
+            ip++;
+        }
+        VM_DISPATCH();
+    }
+
+    VM_CASE(OP_CHECK_BOOL) {
+        if (R[ip->a].type != TYPE_BOOL) {
+            OutputFormat("Type mismatch for '%s' operator\n", ip->c ? "||" : "&&");
+            R[ip->a].type = TYPE_UNKNOWN;
+        }
+        ip++;
+        VM_DISPATCH();
+    }
+
+    VM_CASE(OP_PRINT) {
+        PrintSlot(&R[ip->a]);
+        ip++;
+        VM_DISPATCH();
+    }
+
+    VM_CASE(OP_INPUT_LOCAL) {
+        ReadSlot(vm, &R[ip->a], chunk->names.names[ip->c]);
+        ip++;
+        VM_DISPATCH();
+    }
+
+    VM_CASE(OP_INPUT_GLOBAL) {
+        ReadSlot(vm, &G[ip->b], chunk->names.names[ip->c]);
+        ip++;
+        VM_DISPATCH();
+    }
+
+    VM_CASE(OP_CALL) {
+        VM_CHARGE(1);
+        if (!PushFrame(vm)) {
+            OutputFormat("Error: line %d: call stack overflow\n", chunk->lines[ip - code]);
+            goto stop;
+        }
+#if VM_PROFILING
+        ProfileCall(vm->profile, ip->a, chunk->lines[ip - code]);
+#endif
+        const Function* func = &functions[ip->a];
+        CallFrame* frame = &vm->frames[vm->frame_count - 1];
+        frame->return_ip = ip + 1;
+        frame->base = base;
+        frame->local_count = frame_local_count;
+        frame->result = ip->c < 0 ? -1 : base + ip->c;
+        frame->function = ip->a;
+
+        base += ip->b;
+        frame_local_count = func->local_count;
+        EnsureRegisters(vm, base + func->register_count);
+        R = vm->registers + base;
+        // Parameters now own their arguments; other locals take their type
+        // from the first store of each call
+        for (int i = 0; i < func->param_count; i++) {
+            if (R[i].type == TYPE_STRING) RetainString(R[i].value.stringValue);
+        }
+        for (int i = func->param_count; i < func->local_count; i++) R[i].type = TYPE_UNKNOWN;
+        ip = code + func->entry;
+        VM_LOOP_ENTRY();
+        VM_DISPATCH();
+    }
+
+    VM_CASE(OP_TAILCALL) {
+        // The callee takes over this frame, returning straight to our caller
+        VM_CHARGE(1);
+#if VM_PROFILING
+        ProfileTailCall(vm->profile, ip->a);
+#endif
+        const Function* func = &functions[ip->a];
+        vm->frames[vm->frame_count - 1].function = ip->a;
+        Slot* args = R + ip->b;
+        for (int i = 0; i < func->param_count; i++) {
+            if (args[i].type == TYPE_STRING) RetainString(args[i].value.stringValue);
+        }
+        FreeSlots(R, frame_local_count);
+        memmove(R, args, func->param_count * sizeof(Slot));
+
+        frame_local_count = func->local_count;
+        EnsureRegisters(vm, base + func->register_count);
+        R = vm->registers + base;
+        for (int i = func->param_count; i < func->local_count; i++) R[i].type = TYPE_UNKNOWN;
+        ip = code + func->entry;
+        VM_LOOP_ENTRY();
+        VM_DISPATCH();
+    }
+
+    VM_CASE(OP_RETURN) {
+        Slot result = { TYPE_UNKNOWN };
+        if (ip->b) {
+            result = R[ip->a];
+            if (result.type == TYPE_STRING) RetainString(result.value.stringValue);
+        }
+        FreeSlots(R, frame_local_count);
+        CallFrame* frame = &vm->frames[--vm->frame_count];
+        base = frame->base;
+        frame_local_count = frame->local_count;
+        R = vm->registers + base;
+        ip = frame->return_ip;
+        if (frame->result >= 0) {
+            Slot* target = &vm->registers[frame->result];
+            if (target->type == TYPE_STRING) ReleaseString(target->value.stringValue);
+            *target = result;
+        } else if (result.type == TYPE_STRING) {
+            ReleaseString(result.value.stringValue);
+        }
+#if VM_PROFILING
+        ProfileReturn(vm->profile);
+#endif
+        VM_DISPATCH();
+    }
+
+    VM_CASE(OP_EXIT) {
+        OutputFormat("Program ended with exit code '%s'\n", K[ip->b].value.stringValue->chars);
+        goto done;
+    }
+
+    VM_CASE(OP_HALT) {
+        goto done;
+    }
+
+    VM_INCREMENT(OP_INCR_LOCAL, R[ip->a])
+    VM_INCREMENT(OP_INCR_GLOBAL, G[ip->a])
+
+    VM_COMPARE_JUMPS(EQ, ==)
+    VM_COMPARE_JUMPS(NE, !=)
+    VM_COMPARE_JUMPS(LT, <)
+    VM_COMPARE_JUMPS(GT, >)
+    VM_COMPARE_JUMPS(LE, <=)
+    VM_COMPARE_JUMPS(GE, >=)
+
+    VM_ARITHMETIC_II(OP_ADD_II, OP_ADD, u + v)
+    VM_ARITHMETIC_II(OP_SUB_II, OP_SUB, u - v)
+    VM_ARITHMETIC_II(OP_MUL_II, OP_MUL, u * v)
+
+    VM_CASE(OP_DIV_II) {
+        Slot* x = &R[ip->b];
+        Slot* y = &R[ip->c];
+        if (x->type != TYPE_INT || y->type != TYPE_INT) { VM_DEOPTIMIZE(OP_DIV); }
+        if (y->value.intValue != 0 && !(x->value.intValue == -2147483647 - 1 && y->value.intValue == -1)) {
+            R[ip->a].value.intValue = x->value.intValue / y->value.intValue;
+            R[ip->a].type = TYPE_INT;
+        } else {
+            BinarySlow(&R[ip->a], OPR_DIV, x, y);
+        }
+        ip++;
+        VM_DISPATCH();
+    }
+
+    VM_COMPARISON(OP_EQ_II, OP_EQ, TYPE_INT, intValue, ==)
+    VM_COMPARISON(OP_NE_II, OP_NE, TYPE_INT, intValue, !=)
+    VM_COMPARISON(OP_LT_II, OP_LT, TYPE_INT, intValue, <)
+    VM_COMPARISON(OP_GT_II, OP_GT, TYPE_INT, intValue, >)
+    VM_COMPARISON(OP_LE_II, OP_LE, TYPE_INT, intValue, <=)
+    VM_COMPARISON(OP_GE_II, OP_GE, TYPE_INT, intValue, >=)
+
+    VM_ARITHMETIC_FF(OP_ADD_FF, OP_ADD, +)
+    VM_ARITHMETIC_FF(OP_SUB_FF, OP_SUB, -)
+    VM_ARITHMETIC_FF(OP_MUL_FF, OP_MUL, *)
+
+    VM_CASE(OP_DIV_FF) {
+        Slot* x = &R[ip->b];
+        Slot* y = &R[ip->c];
+        if (x->type != TYPE_FLOAT || y->type != TYPE_FLOAT) { VM_DEOPTIMIZE(OP_DIV); }
+        if (y->value.floatValue != 0.0f) {
+            R[ip->a].value.floatValue = x->value.floatValue / y->value.floatValue;
+            R[ip->a].type = TYPE_FLOAT;
+        } else {
+            BinarySlow(&R[ip->a], OPR_DIV, x, y);
+        }
+        ip++;
+        VM_DISPATCH();
+    }
+
+    VM_COMPARISON(OP_EQ_FF, OP_EQ, TYPE_FLOAT, floatValue, ==)
+    VM_COMPARISON(OP_NE_FF, OP_NE, TYPE_FLOAT, floatValue, !=)
+    VM_COMPARISON(OP_LT_FF, OP_LT, TYPE_FLOAT, floatValue, <)
+    VM_COMPARISON(OP_GT_FF, OP_GT, TYPE_FLOAT, floatValue, >)
+    VM_COMPARISON(OP_LE_FF, OP_LE, TYPE_FLOAT, floatValue, <=)
+    VM_COMPARISON(OP_GE_FF, OP_GE, TYPE_FLOAT, floatValue, >=)
+
+    VM_END
+
+stop:
+    status = 0;
+done:
+    if (vm->sampler) StopSampling(vm);
+#if VM_PROFILING
+    FinishProfile(vm->profile, vm->allocations, MonotonicSeconds());
+#endif
+    // Release the string locals of frames still active after an exit
+    while (vm->frame_count > 0) {
+        FreeSlots(R, frame_local_count);
+        CallFrame* frame = &vm->frames[--vm->frame_count];
+        frame_local_count = frame->local_count;
+        R = vm->registers + frame->base;
+    }
+    FreeSlots(R, frame_local_count);
+    FreeSlots(G, chunk->globals.count);
+    free(G);
+    return status;
+}
+
+#undef VM_STEP
+#undef VM_LOOP_ENTRY
+#undef VM_LOOP_NAME
+#undef VM_PROFILING
+#undef VM_JIT
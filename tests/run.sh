@@ -0,0 +1,351 @@
+#!/usr/bin/env bash
+# Regression tests of the interpreter:
+#
+#   tests/run.sh [interpreter]
+#
+# Without an interpreter it builds one with $CC (default cc), plus the
+# portable switch-dispatch build and, unless SANITIZE=0, builds with
+# AddressSanitizer and ThreadSanitizer.
+#
+# Every tests/scripts/NAME.txt runs at -O0, -O1 and -O2 and with --no-jit,
+# and must print NAME.out each time, followed by "[exit N]" when the
+# interpreter exits with a nonzero status. NAME.args holds extra options
+# and NAME.in the script's standard input. Generated scripts, and options
+# that need more than one run, have checks of their own.
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+SCRIPTS="$ROOT/tests/scripts"
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+CC=${CC:-cc}
+SOURCES="$ROOT/src/main.c $ROOT/src/interpreter/interpreter.c"
+
+checks=0
+failures=0
+
+fail() {
+    echo "FAIL: $*"
+    failures=$((failures + 1))
+}
+
+build() {
+    local output=$1
+    shift
+    $CC -O2 -pthread "$@" -o "$output" $SOURCES 2> "$WORK/build.log"
+}
+
+# Runs a script of the suite, writing what it printed and its exit status
+# to file
+run_script() {
+    local file=$1 name=$2
+    shift 2
+    local args="" input=/dev/null
+    [ -f "$SCRIPTS/$name.args" ] && args=$(cat "$SCRIPTS/$name.args")
+    [ -f "$SCRIPTS/$name.in" ] && input="$SCRIPTS/$name.in"
+    "$@" $args "$SCRIPTS/$name.txt" < "$input" > "$file" 2>&1
+    local status=$?
+    [ $status -ne 0 ] && echo "[exit $status]" >> "$file"
+}
+
+# Runs every script once for each set of options given after the
+# interpreter
+check_scripts() {
+    local interpreter=$1
+    shift
+    for script in "$SCRIPTS"/*.txt; do
+        local name
+        name=$(basename "$script" .txt)
+        for options in "$@"; do
+            checks=$((checks + 1))
+            run_script "$WORK/actual" "$name" "$interpreter" $options
+            if ! cmp -s "$WORK/actual" "$SCRIPTS/$name.out"; then
+                fail "$name with $(basename "$interpreter")${options:+ $options}"
+                diff "$SCRIPTS/$name.out" "$WORK/actual" | head -10
+            fi
+        done
+    done
+}
+
+# Native code charges the budget exactly like the interpreter, so a run
+# stops at the same point and prints the same with or without the JIT
+check_budgets() {
+    local interpreter=$1
+    for script in "$SCRIPTS"/jit_*.txt "$SCRIPTS"/superinstructions.txt; do
+        for budget in 1000 5000 123457; do
+            for level in -O0 -O2; do
+                checks=$((checks + 1))
+                "$interpreter" $level --budget $budget "$script" < /dev/null > "$WORK/jit" 2>&1
+                "$interpreter" $level --no-jit --budget $budget "$script" < /dev/null > "$WORK/nojit" 2>&1
+                cmp -s "$WORK/jit" "$WORK/nojit" ||
+                    fail "$(basename "$script") differs with --budget $budget $level"
+            done
+        done
+    done
+}
+
+# The first run compiles the script into the cache and the second maps it
+check_cache() {
+    local interpreter=$1 cache
+    cache=$(mktemp -d "$WORK/cache.XXXXXX")
+    for pass in compile load; do
+        checks=$((checks + 1))
+        "$interpreter" --cache "$cache" "$SCRIPTS/functions.txt" < /dev/null > "$WORK/actual" 2>&1
+        cmp -s "$WORK/actual" "$SCRIPTS/functions.out" || fail "cache $pass"
+    done
+    checks=$((checks + 1))
+    [ "$(ls "$cache" | wc -l)" -eq 1 ] || fail "cache holds $(ls "$cache" | wc -l) files"
+    check_damaged_cache "$interpreter"
+    check_colliding_cache "$interpreter"
+}
+
+# Writes value as a little-endian integer of 4 bytes, or of the given
+# size, at a byte offset of a file
+write_int() {
+    local value=$3 size=${4:-4} bytes="" i
+    for ((i = 0; i < size; i++)); do
+        bytes+=$(printf '\\%03o' $((value >> i * 8 & 255)))
+    done
+    printf "$bytes" | dd of="$1" bs=1 seek="$2" conv=notrunc 2> /dev/null
+}
+
+# Sets each operand of each cached instruction in turn far out of range.
+# No run may fail, and when the loader rejects the file the script must
+# compile again, replacing the file, and print what it prints without a
+# cache. The constant of the first instruction, a LOADK, must be rejected.
+check_damaged_cache() {
+    local interpreter=$1 cache file count code status before
+    cache=$(mktemp -d "$WORK/cache.XXXXXX")
+    cat > "$WORK/damaged.txt" <<'EOF'
+function twice(n) {
+    return n * 2
+}
+int i = 0
+while i < 3
+    i = i + 1
+endwhile
+print twice(i)
+EOF
+    "$interpreter" -O0 --cache "$cache" "$WORK/damaged.txt" < /dev/null > /dev/null 2>&1
+    file=$(echo "$cache"/*)
+    cp "$file" "$WORK/pristine"
+    # The header's code_count is at byte 24 and the offset of the code at
+    # byte 64; an instruction is 16 bytes, with a, b and c from byte 4
+    count=$(od -An -t d4 -j 24 -N 4 "$file" | tr -d ' ')
+    code=$(od -An -t u8 -j 64 -N 8 "$file" | tr -d ' ')
+    for ((i = 0; i < count; i++)); do
+        for operand in 0 1 2; do
+            checks=$((checks + 1))
+            cp "$WORK/pristine" "$file"
+            write_int "$file" $((code + i * 16 + 4 + operand * 4)) 100000000
+            before=$(ls -i "$file")
+            "$interpreter" -O0 --cache "$cache" "$WORK/damaged.txt" < /dev/null > "$WORK/actual" 2>&1
+            status=$?
+            if [ $status -ne 0 ]; then
+                fail "cache damaged at instruction $i operand $operand exits with $status"
+            elif [ "$(ls -i "$file")" != "$before" ]; then
+                [ "$(cat "$WORK/actual")" = 6 ] ||
+                    fail "cache damaged at instruction $i operand $operand printed $(head -c 200 "$WORK/actual")"
+            elif [ $i -eq 0 ] && [ $operand -eq 1 ]; then
+                fail "cache damaged at instruction 0 operand 1 was used"
+            fi
+        done
+    done
+}
+
+# Two scripts of the same size whose keys collide: the second finds the
+# first one's file under its own name, with its own key in the header, and
+# must compile itself rather than run the other script's bytecode
+check_colliding_cache() {
+    local interpreter=$1 cache first second
+    cache=$(mktemp -d "$WORK/cache.XXXXXX")
+    echo 'print 1' > "$WORK/first.txt"
+    echo 'print 2' > "$WORK/second.txt"
+    "$interpreter" --cache "$cache" "$WORK/first.txt" < /dev/null > /dev/null 2>&1
+    first=$(echo "$cache"/*)
+    "$interpreter" --cache "$cache" "$WORK/second.txt" < /dev/null > /dev/null 2>&1
+    second=$(ls "$cache"/* | grep -v "$first")
+    cp "$first" "$second"
+    # The key is the file's name, and sits at byte 8 of the header
+    write_int "$second" 8 "0x$(basename "$second" .mic)" 8
+    checks=$((checks + 1))
+    "$interpreter" --cache "$cache" "$WORK/second.txt" < /dev/null > "$WORK/actual" 2>&1
+    [ "$(cat "$WORK/actual")" = 2 ] || fail "colliding cache file printed $(head -c 200 "$WORK/actual")"
+}
+
+# Inputs get less work the later they come, so workers finish out of order;
+# the output must still be the runs' outputs in input order
+make_batch() {
+    local count=$1
+    cat > "$WORK/batch.txt" <<'EOF'
+int n = 0
+input n
+int i = 0
+int sum = 0
+while i < n * 20000
+    sum = sum + i
+    i = i + 1
+endwhile
+print n
+print sum
+EOF
+    BATCH_INPUTS=()
+    for i in $(seq 1 "$count"); do
+        echo $((count + 1 - i)) > "$WORK/input$i"
+        BATCH_INPUTS+=("$WORK/input$i")
+    done
+}
+
+check_batch() {
+    local interpreter=$1
+    make_batch 12
+    : > "$WORK/expected"
+    for input in "${BATCH_INPUTS[@]}"; do
+        "$interpreter" "$WORK/batch.txt" < "$input" >> "$WORK/expected" 2>&1
+    done
+    for jobs in 1 4; do
+        checks=$((checks + 1))
+        "$interpreter" --jobs $jobs --batch "$WORK/batch.txt" "${BATCH_INPUTS[@]}" > "$WORK/actual" 2>&1
+        cmp -s "$WORK/actual" "$WORK/expected" || fail "batch with --jobs $jobs"
+    done
+    checks=$((checks + 1))
+    "$interpreter" --batch "$WORK/batch.txt" "$WORK/input1" "$WORK/missing" > /dev/null 2>&1
+    [ $? -eq 2 ] || fail "batch with a missing input does not exit with 2"
+}
+
+# Compares the execution count of every line and the call count of every
+# function in the profile. A line counts once each time its statement
+# starts, not again when a call on it returns.
+check_profile() {
+    local interpreter=$1
+    cat > "$WORK/profile.txt" <<'EOF'
+function fib(n) {
+    if n < 2
+        return n
+    endif
+    return fib(n - 1) + fib(n - 2)
+}
+int i = 0
+while i < 3
+    i = i + 1
+endwhile
+print fib(10)
+EOF
+    checks=$((checks + 1))
+    "$interpreter" --profile "$WORK/profile" "$WORK/profile.txt" < /dev/null > /dev/null 2>&1
+    local counts expected
+    counts=$(awk -F'\t' '$1 == "function" || ($1 == "line" && $2 > 0) { print $1, $2, $3 }' "$WORK/profile")
+    expected=$(printf 'line %s\n' "2 177" "3 89" "5 88" "7 1" "8 4" "9 3" "11 1"
+               printf 'function %s\n' "fib 177" "<main> 1")
+    [ "$counts" = "$expected" ] || fail "profile counts $(echo $counts)"
+}
+
+# A run long enough to be sampled must record the loop in its function
+check_sample() {
+    local interpreter=$1
+    cat > "$WORK/sample.txt" <<'EOF'
+function spin(n) {
+    int i = 0
+    while i < n
+        i = i + 1
+    endwhile
+    return i
+}
+print spin(20000000)
+EOF
+    checks=$((checks + 1))
+    "$interpreter" --sample "$WORK/sample" "$WORK/sample.txt" < /dev/null > /dev/null 2>&1
+    grep -Eq '^<main>:8;spin:3 [0-9]+$' "$WORK/sample" || fail "no samples of spin's loop"
+}
+
+# Runs a generated script with a time limit, comparing what it prints
+check_generated() {
+    local interpreter=$1 name=$2 expected=$3
+    shift 3
+    checks=$((checks + 1))
+    timeout 5 "$interpreter" "$@" "$WORK/$name.txt" < /dev/null > "$WORK/actual" 2>&1
+    local status=$?
+    if [ $status -eq 124 ]; then
+        fail "$name${*:+ $*} takes over 5 seconds"
+    elif [ "$(cat "$WORK/actual")" != "$expected" ]; then
+        fail "$name${*:+ $*} printed $(head -c 200 "$WORK/actual")"
+    fi
+}
+
+check_large_scripts() {
+    local interpreter=$1
+    # Far past the 100 lines scripts used to be cut at
+    awk 'BEGIN { print "int n = 0"
+                 for (i = 0; i < 5000; i++) print "n = n + 1"
+                 print "print n" }' > "$WORK/many_lines.txt"
+    # A register for every call result and 66,000 locals, past 16 bits
+    awk 'BEGIN { print "function one() {\n    return 1\n}\nint s = 0"
+                 for (i = 0; i < 70000; i++) print "s = s + one()"
+                 print "print s" }' > "$WORK/many_calls.txt"
+    awk 'BEGIN { print "function f() {"
+                 for (i = 0; i < 66000; i++) print "    int v" i " = " i
+                 print "    print v0\n    print v1\n    print v65999\n}\nf()" }' > "$WORK/many_locals.txt"
+    # Load time must stay linear in the number of lines
+    awk 'BEGIN { print "int v0 = 1"
+                 for (i = 1; i < 40000; i++) print "int v" i " = v" i - 1 " + 1"
+                 print "print v39999"
+                 print "function f() {\n    int w0 = 1"
+                 for (i = 1; i < 40000; i++) print "    int w" i " = w" i - 1 " + 1"
+                 print "    print w39999\n}\nf()" }' > "$WORK/many_declarations.txt"
+    awk 'BEGIN { print "function f(n) {\n    int s = 0\n    int i = 0"
+                 for (i = 0; i < 10000; i++) print "    int v" i " = " i
+                 print "    while i < n"
+                 for (i = 0; i < 10000; i++) print "        s = s + v" i " * 3 + v" (i * 7) % 10000
+                 print "        i = i + 1\n    endwhile\n    return s\n}\nprint f(3)" }' > "$WORK/long_loop.txt"
+    for level in -O0 -O1 -O2; do
+        check_generated "$interpreter" many_lines 5000 $level
+        check_generated "$interpreter" many_calls 70000 $level
+        check_generated "$interpreter" many_locals "$(printf '0\n1\n65999')" $level
+        check_generated "$interpreter" many_declarations "$(printf '40000\n40000')" $level
+        check_generated "$interpreter" long_loop 599940000 $level
+    done
+    check_generated "$interpreter" long_loop 599940000 --passes constprop,licm
+}
+
+if [ $# -gt 0 ]; then
+    INTERPRETER=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+    BUILDS=("$INTERPRETER")
+else
+    INTERPRETER="$WORK/mini-interpreter"
+    build "$INTERPRETER" || { cat "$WORK/build.log"; exit 1; }
+    build "$WORK/mini-interpreter-switch" -DMINI_NO_COMPUTED_GOTO || { cat "$WORK/build.log"; exit 1; }
+    BUILDS=("$INTERPRETER" "$WORK/mini-interpreter-switch")
+fi
+
+for interpreter in "${BUILDS[@]}"; do
+    check_scripts "$interpreter" -O0 -O1 -O2 "-O2 --no-jit"
+    check_budgets "$interpreter"
+done
+check_cache "$INTERPRETER"
+check_batch "$INTERPRETER"
+check_profile "$INTERPRETER"
+check_sample "$INTERPRETER"
+check_large_scripts "$INTERPRETER"
+
+if [ $# -eq 0 ] && [ "${SANITIZE:-1}" != 0 ]; then
+    if build "$WORK/mini-interpreter-asan" -g -fsanitize=address,undefined -fno-sanitize-recover=all; then
+        check_scripts "$WORK/mini-interpreter-asan" -O2 "-O0 --no-jit"
+        check_cache "$WORK/mini-interpreter-asan"
+    else
+        echo "skipped: AddressSanitizer build failed"
+    fi
+    # Workers steal from each other's deques while they run
+    if build "$WORK/mini-interpreter-tsan" -g -fsanitize=thread; then
+        make_batch 40
+        checks=$((checks + 1))
+        "$WORK/mini-interpreter-tsan" --jobs 4 --batch "$WORK/batch.txt" "${BATCH_INPUTS[@]}" > /dev/null 2> "$WORK/tsan.log"
+        if grep -q ThreadSanitizer "$WORK/tsan.log"; then
+            fail "ThreadSanitizer reports on --batch"
+            head -30 "$WORK/tsan.log"
+        fi
+    else
+        echo "skipped: ThreadSanitizer build failed"
+    fi
+fi
+
+echo "$((checks - failures)) of $checks checks passed"
+[ $failures -eq 0 ]